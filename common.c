@@ -5,6 +5,7 @@
 #include <ctype.h>
 #include <errno.h>
 #include <sys/time.h>
+#include <sys/resource.h>
 
 struct information info;
 
@@ -31,6 +32,48 @@ FILE *open_file(const char *file, int *reported) {
   return fp;
 }
 
+/* fd limit torsmo was started with, commands are run with it instead of the
+ * one from raise_fd_limit() */
+static struct rlimit start_fd_limit, raised_fd_limit;
+static int fd_limit_raised;
+
+/* raises soft limit of open files up to n if hard limit allows, returns
+ * the limit */
+unsigned long raise_fd_limit(unsigned long n) {
+  struct rlimit rl;
+
+  if (getrlimit(RLIMIT_NOFILE, &rl) != 0)
+    return 0;
+
+  if (rl.rlim_cur < rl.rlim_max && rl.rlim_cur < n) {
+    start_fd_limit = rl;
+    rl.rlim_cur = rl.rlim_max < n ? rl.rlim_max : n;
+    if (setrlimit(RLIMIT_NOFILE, &rl) == 0) {
+      raised_fd_limit = rl;
+      fd_limit_raised = 1;
+    }
+    getrlimit(RLIMIT_NOFILE, &rl);
+  }
+
+  return rl.rlim_cur;
+}
+
+#ifdef HAVE_POPEN
+/* popen() for exec, execi and pre_exec, command doesn't inherit the raised
+ * fd limit */
+FILE *exec_popen(const char *cmd) {
+  FILE *fp;
+
+  if (fd_limit_raised)
+    setrlimit(RLIMIT_NOFILE, &start_fd_limit);
+  fp = popen(cmd, "r");
+  if (fd_limit_raised)
+    setrlimit(RLIMIT_NOFILE, &raised_fd_limit);
+
+  return fp;
+}
+#endif
+
 void variable_substitute(const char *s, char *dest, unsigned int n) {
   while (*s && n > 1) {
     if (*s == '$') {
@@ -108,6 +151,77 @@ struct net_stat *get_net_stat(const char *dev) {
   return 0;
 }
 
+/* file descriptors that wake up main_loop(), handler returns non-zero if
+ * text should be updated */
+
+static struct update_fd {
+  int fd;
+  int pri;      /* watched for exceptional condition (POLLPRI) */
+  int (*handler)(int fd);
+} update_fds[32];
+
+static void add_fd(int fd, int (*handler)(int fd), int pri) {
+  unsigned int i;
+
+  for (i=0; i<32; i++) {
+    if (update_fds[i].handler == NULL) {
+      update_fds[i].fd = fd;
+      update_fds[i].pri = pri;
+      update_fds[i].handler = handler;
+      return;
+    }
+  }
+
+  ERR("too many file descriptors to watch (limit is 32)");
+}
+
+void add_update_fd(int fd, int (*handler)(int fd)) {
+  add_fd(fd, handler, 0);
+}
+
+/* for files that signal with POLLPRI, like PSI triggers */
+void add_update_pri_fd(int fd, int (*handler)(int fd)) {
+  add_fd(fd, handler, 1);
+}
+
+void remove_update_fd(int fd) {
+  unsigned int i;
+
+  for (i=0; i<32; i++) {
+    if (update_fds[i].handler && update_fds[i].fd == fd)
+      update_fds[i].handler = NULL;
+  }
+}
+
+/* adds watched fds to sets, returns highest fd */
+int set_update_fds(fd_set *set, fd_set *pri_set, int maxfd) {
+  unsigned int i;
+
+  for (i=0; i<32; i++) {
+    if (update_fds[i].handler) {
+      FD_SET(update_fds[i].fd, update_fds[i].pri ? pri_set : set);
+      if (update_fds[i].fd > maxfd)
+        maxfd = update_fds[i].fd;
+    }
+  }
+
+  return maxfd;
+}
+
+int handle_update_fds(fd_set *set, fd_set *pri_set) {
+  unsigned int i;
+  int r = 0;
+
+  for (i=0; i<32; i++) {
+    /* handler may remove itself */
+    if (update_fds[i].handler &&
+        FD_ISSET(update_fds[i].fd, update_fds[i].pri ? pri_set : set))
+      r |= update_fds[i].handler(update_fds[i].fd);
+  }
+
+  return r;
+}
+
 void format_seconds(char *buf, unsigned int n, long t) {
   if(t >= 24*60*60) /* hours necessary when there are days? */
     snprintf(buf, n, "%ldd %ldh %ldm", t/60/60/24,
@@ -133,11 +247,30 @@ void format_seconds_short(char *buf, unsigned int n, long t) {
     snprintf(buf, n, "%ldm", t/60);
 }
 
-static double last_meminfo_update;
 static double last_fs_update;
 
 unsigned int need_mask;
 
+static void update_acpi_fan() {
+  snprintf(info.acpi_fan, 64, "%s", get_acpi_fan());
+  info.mask |= (1U << INFO_ACPI_FAN);
+}
+
+static void update_acpi_ac() {
+  snprintf(info.acpi_ac_adapter, 64, "%s", get_acpi_ac_adapter());
+  info.mask |= (1U << INFO_ACPI_AC);
+}
+
+static void update_adt746x_cpu() {
+  snprintf(info.adt746x_cpu, 16, "%s", get_adt746x_cpu());
+  info.mask |= (1U << INFO_ADT746X_CPU);
+}
+
+static void update_adt746x_fan() {
+  snprintf(info.adt746x_fan, 64, "%s", get_adt746x_fan());
+  info.mask |= (1U << INFO_ADT746X_FAN);
+}
+
 void update_stuff() {
   unsigned int i;
 
@@ -158,7 +291,7 @@ void update_stuff() {
 
   prepare_update();
 
-#define NEED(a) ((need_mask & (1 << a)) && ((info.mask & (1 << a)) == 0))
+#define NEED(a) ((need_mask & (1U << a)) && ((info.mask & (1U << a)) == 0))
 
   if (NEED(INFO_UPTIME)) update_uptime();
 
@@ -168,6 +301,34 @@ void update_stuff() {
 
   if (NEED(INFO_CPU)) update_cpu_usage();
 
+  if (NEED(INFO_STAT)) update_stat_counters();
+
+  if (NEED(INFO_IRQ)) update_irqs();
+
+  if (NEED(INFO_SCHED)) update_schedstat();
+
+  if (NEED(INFO_FREQ)) update_freq();
+
+  if (NEED(INFO_CSTATE)) update_cstates();
+
+  if (NEED(INFO_I2C)) update_hwmon();
+
+  if (NEED(INFO_THERMAL)) update_thermal();
+
+  if (NEED(INFO_POWER)) update_power_supplies();
+
+  if (NEED(INFO_RAPL)) update_rapl();
+
+  if (NEED(INFO_MIXER)) update_mixer();
+
+  if (NEED(INFO_ACPI_FAN)) update_acpi_fan();
+
+  if (NEED(INFO_ACPI_AC)) update_acpi_ac();
+
+  if (NEED(INFO_ADT746X_CPU)) update_adt746x_cpu();
+
+  if (NEED(INFO_ADT746X_FAN)) update_adt746x_fan();
+
   if (NEED(INFO_NET)) update_net_stats();
 
   if (NEED(INFO_MAIL)) update_mail_count();
@@ -178,15 +339,28 @@ void update_stuff() {
 
   if (NEED(INFO_LOADAVG)) update_load_average();
 
-  if ((NEED(INFO_MEM) || NEED(INFO_BUFFERS)) &&
-      current_update_time - last_meminfo_update > 6.9) {
+  if (NEED(INFO_TOP)) update_top();
+
+  if (NEED(INFO_PCOUNT)) update_pcounts();
+
+  if (NEED(INFO_PROC)) update_watched_procs();
+
+  if (NEED(INFO_CGROUP)) update_cgroups();
+
+  if (NEED(INFO_PSI)) update_psi();
+
+  if (NEED(INFO_VMSTAT)) update_vmstat();
+
+  /* meminfo is kept open and read in one pass, no need to skip updates */
+  if (NEED(INFO_MEM) || NEED(INFO_BUFFERS)) {
     update_meminfo();
     if (no_buffers) info.mem -= info.bufmem;
-    last_meminfo_update = current_update_time;
   }
 
-  /* update_fs_stat() won't do anything if there aren't fs -things */
-  if (NEED(INFO_FS) && current_update_time - last_fs_update > 12.9) {
+  /* update_fs_stat() won't do anything if there aren't fs -things, new ones
+   * are read on next update */
+  if (NEED(INFO_FS) && (current_update_time - last_fs_update > 12.9 ||
+      unread_fs_stats)) {
     update_fs_stats();
     last_fs_update = current_update_time;
   }
@@ -3,7 +3,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <ctype.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
 #include <fcntl.h>
 
 /* linux */
@@ -19,79 +26,429 @@
 #include <sys/mount.h>
 #endif
 
-/* TODO: benchmark which is faster, fstatvfs() or pre-opened fd and
- * statvfs() (fstatvfs() would handle mounts I think...) */
+/* fs stats are kept in a list so that text objects can hold pointers to
+ * them while the list grows */
+static struct fs_stat *fs_stats;
 
-static struct fs_stat fs_stats_[64];
-struct fs_stat *fs_stats = fs_stats_;
+#define MOUNTINFO "/proc/self/mountinfo"
 
-void update_fs_stats() {
-  unsigned int i;
+/* kernel flags POLLPRI on this fd when the mount table changes (Linux), it
+ * stays -1 where there is no such file */
+static int mountinfo_fd = -1;
+static int mountinfo_tried;
+
+/* mount table for fs_all, reread only after mounts_changed() */
+static struct fs_mount *fs_mounts;
+static unsigned int fs_mount_count;
+static int fs_mounts_stale = 1;
+
+/* statfs() (and any other look up of the path) blocks forever on a hung NFS
+ * or FUSE mount, so it's called by a helper process and each file system gets
+ * fs_timeout seconds to answer (0 means statfs() is called directly). No fd
+ * is kept open, that would make unmounting fail with EBUSY. */
+double fs_timeout = 2.0;
+
+/* set when there are fs_stats made after last update_fs_stats() */
+int unread_fs_stats;
+
+static pid_t fs_helper_pid = -1;
+static int fs_helper_sock = -1;
+
+/* helpers that got stuck with a file system that was then removed */
+static pid_t *orphan_helpers;
+static unsigned int orphan_helper_count;
+
+struct fs_reply {
+  int ok;
+  long long blocks, bsize, bavail, files, ffree;
+};
+
+/* returns 1 if something was mounted or unmounted since last call */
+static int mounts_changed() {
+  struct pollfd pfd;
+
+  if (mountinfo_fd < 0) {
+    if (mountinfo_tried) return 0;
+    mountinfo_tried = 1;
+
+    /* opening it syncs the event counter, all fds are fresh anyway */
+    mountinfo_fd = open(MOUNTINFO, O_RDONLY);
+    if (mountinfo_fd < 0) return 0;
+  }
+
+  pfd.fd = mountinfo_fd;
+  pfd.events = POLLPRI;
+  pfd.revents = 0;
+
+  if (poll(&pfd, 1, 0) <= 0) return 0;
+
+  return (pfd.revents & (POLLPRI | POLLERR)) != 0;
+}
+
+static void statfs_reply(const char *path, struct fs_reply *r) {
   struct statfs s;
-  for (i=0; i<16; i++) {
-    if (fs_stats[i].fd <= 0)
+
+  memset(r, 0, sizeof(*r));
+  if (statfs(path, &s) == 0) {
+    r->ok = 1;
+    r->blocks = (long long) s.f_blocks;
+    r->bsize = (long long) s.f_bsize;
+    r->bavail = (long long) s.f_bavail;
+    r->files = (long long) s.f_files;
+    r->ffree = (long long) s.f_ffree;
+  }
+}
+
+/* request is length of path followed by the path */
+static void fs_helper(int sock) {
+  char path[PATH_MAX];
+  unsigned int len;
+
+  signal(SIGINT, SIG_DFL);
+  signal(SIGTERM, SIG_DFL);
+  signal(SIGUSR1, SIG_DFL);
+
+  /* exits when torsmo closes the socket */
+  while (recv(sock, &len, sizeof(len), MSG_WAITALL) == sizeof(len) &&
+      len < PATH_MAX &&
+      recv(sock, path, len, MSG_WAITALL) == (ssize_t) len) {
+    struct fs_reply r;
+
+    path[len] = '\0';
+    statfs_reply(path, &r);
+    if (write(sock, &r, sizeof(r)) != sizeof(r))
       break;
+  }
+
+  _exit(0);
+}
+
+static int start_fs_helper() {
+  int sv[2];
 
-    fstatfs(fs_stats[i].fd, &s);
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+    ERR("socketpair: %s", strerror(errno));
+    return 0;
+  }
+
+  fs_helper_pid = fork();
+  if (fs_helper_pid == -1) {
+    ERR("can't fork fs helper: %s", strerror(errno));
+    close(sv[0]);
+    close(sv[1]);
+    return 0;
+  }
 
-    fs_stats[i].size = (long long) s.f_blocks * s.f_bsize;
-    /* bfree (root) or bavail (non-roots) ? */
-    fs_stats[i].avail = (long long) s.f_bavail * s.f_bsize;
+  if (fs_helper_pid == 0) {
+    close(sv[0]);
+    fs_helper(sv[1]);
   }
+
+  close(sv[1]);
+  fs_helper_sock = sv[0];
+  return 1;
 }
 
-void clear_fs_stats() {
+static void stop_fs_helper() {
+  if (fs_helper_pid < 0)
+    return;
+
+  /* helper is idle so it exits right away */
+  close(fs_helper_sock);
+  waitpid(fs_helper_pid, NULL, 0);
+  fs_helper_pid = -1;
+  fs_helper_sock = -1;
+}
+
+/* helper is stuck in statfs(), leave it to fs and start a new one for
+ * other file systems */
+static void abandon_fs_helper(struct fs_stat *fs) {
+  kill(fs_helper_pid, SIGKILL);
+  close(fs_helper_sock);
+  fs->hung_pid = fs_helper_pid;
+  fs_helper_pid = -1;
+  fs_helper_sock = -1;
+}
+
+/* returns 1 on success, 0 on timeout and -1 if helper can't be used */
+static int helper_statfs(struct fs_stat *fs, struct fs_reply *r) {
+  struct pollfd pfd;
+  unsigned int len = strlen(fs->path);
+  double end;
+  int n;
+
+  if (len >= PATH_MAX)
+    return -1;
+
+  if (fs_helper_pid < 0 && !start_fs_helper())
+    return -1;
+
+  if (send(fs_helper_sock, &len, sizeof(len), MSG_NOSIGNAL) != sizeof(len) ||
+      send(fs_helper_sock, fs->path, len, MSG_NOSIGNAL) != (ssize_t) len) {
+    stop_fs_helper();
+    return -1;
+  }
+
+  pfd.fd = fs_helper_sock;
+  pfd.events = POLLIN;
+
+  /* signals (reload, exited exec child) don't count as timeout */
+  end = get_time() + fs_timeout;
+  do {
+    double left = end - get_time();
+    n = poll(&pfd, 1, left > 0 ? (int) (left * 1000) : 0);
+  } while (n < 0 && errno == EINTR);
+
+  if (n == 0) {
+    ERR("file system '%s' didn't answer in %g s", fs->path, fs_timeout);
+    abandon_fs_helper(fs);
+    return 0;
+  }
+  if (n < 0) {
+    stop_fs_helper();
+    return -1;
+  }
+
+  if (recv(fs_helper_sock, r, sizeof(*r), MSG_WAITALL) != sizeof(*r)) {
+    stop_fs_helper();
+    return -1;
+  }
+
+  return 1;
+}
+
+static void read_fs_stat(struct fs_stat *fs) {
+  struct fs_reply r;
+
+  /* don't ask again before the stuck helper is gone, old values are kept */
+  if (fs->hung_pid > 0) {
+    if (waitpid(fs->hung_pid, NULL, WNOHANG) == 0)
+      return;
+    fs->hung_pid = 0;
+  }
+
+  switch (fs_timeout > 0 ? helper_statfs(fs, &r) : -1) {
+  case 0:
+    fs->stale = 1;
+    return;
+
+  case -1:
+    statfs_reply(fs->path, &r);
+    break;
+  }
+
+  if (!r.ok)
+    return;
+
+  fs->stale = 0;
+  fs->size = r.blocks * r.bsize;
+  /* bfree (root) or bavail (non-roots) ? */
+  fs->avail = r.bavail * r.bsize;
+  fs->files = r.files;
+  fs->ffree = r.ffree;
+}
+
+static void reap_orphan_helpers() {
+  unsigned int i = 0;
+
+  while (i < orphan_helper_count) {
+    if (waitpid(orphan_helpers[i], NULL, WNOHANG) != 0)
+      orphan_helpers[i] = orphan_helpers[--orphan_helper_count];
+    else
+      i++;
+  }
+}
+
+static void free_fs_stat(struct fs_stat *fs) {
+  if (fs->hung_pid > 0) {
+    orphan_helpers = (pid_t *) realloc(orphan_helpers,
+        sizeof(pid_t) * (orphan_helper_count + 1));
+    orphan_helpers[orphan_helper_count++] = fs->hung_pid;
+  }
+
+  free(fs->path);
+  free(fs);
+}
+
+void update_fs_stats() {
+  struct fs_stat *fs;
+
+  reap_orphan_helpers();
+
+  if (mounts_changed())
+    fs_mounts_stale = 1;
+
+  unread_fs_stats = 0;
+  for (fs = fs_stats; fs; fs = fs->next)
+    read_fs_stat(fs);
+}
+
+static void free_fs_mounts(struct fs_mount *m, unsigned int n, int release) {
   unsigned int i;
-  for (i=0; i<16; i++) {
-    if (fs_stats[i].fd) {
-      close(fs_stats[i].fd);
-      fs_stats[i].fd = -1;
+
+  for (i=0; i<n; i++) {
+    if (release && m[i].fs)
+      release_fs_stat(m[i].fs);
+    free(m[i].dir);
+    free(m[i].type);
+    free(m[i].dev);
+  }
+  free(m);
+}
+
+void clear_fs_stats() {
+  free_fs_mounts(fs_mounts, fs_mount_count, 0);
+  fs_mounts = NULL;
+  fs_mount_count = 0;
+  fs_mounts_stale = 1;
+
+  while (fs_stats) {
+    struct fs_stat *fs = fs_stats;
+    fs_stats = fs->next;
+    free_fs_stat(fs);
+  }
+}
+
+struct fs_stat *prepare_fs_stat(const char *s) {
+  struct fs_stat *fs, **last = &fs_stats;
+
+  for (fs = fs_stats; fs; fs = fs->next) {
+    if (strcmp(fs->path, s) == 0) {
+      fs->refs++;
+      return fs;
+    }
+    last = &fs->next;
+  }
+
+  fs = (struct fs_stat *) calloc(1, sizeof(struct fs_stat));
+  fs->path = strdup(s);
+  fs->refs = 1;
+  /* not read here, a hung mount would stall the caller, update_fs_stats()
+   * does the first read */
+  fs->stale = 1;
+  unread_fs_stats = 1;
+  *last = fs;
+  return fs;
+}
+
+/* drops a reference from prepare_fs_stat(), fs is freed when there are no
+ * more users */
+void release_fs_stat(struct fs_stat *fs) {
+  struct fs_stat **p;
+
+  if (--fs->refs > 0)
+    return;
+
+  for (p = &fs_stats; *p; p = &(*p)->next) {
+    if (*p == fs) {
+      *p = fs->next;
+      break;
     }
+  }
+
+  free_fs_stat(fs);
+}
+
+/* mountinfo escapes spaces and such as \ooo */
+static char *unescape_mount_field(const char *s) {
+  char *r = strdup(s), *p = r;
 
-    if (fs_stats[i].path != NULL) {
-      free(fs_stats[i].path);
-      fs_stats[i].path = NULL;
+  while (*s) {
+    if (s[0] == '\\' && isdigit((int) s[1]) && isdigit((int) s[2]) &&
+        isdigit((int) s[3])) {
+      *p++ = (char) ((s[1]-'0')*64 + (s[2]-'0')*8 + (s[3]-'0'));
+      s += 4;
     }
+    else
+      *p++ = *s++;
   }
+  *p = '\0';
+
+  return r;
 }
 
-struct fs_stat *prepare_fs_stat(const char *s) {
-  unsigned int i;
+static void read_fs_mounts() {
+  static int rep;
+  struct fs_mount *m = NULL;
+  unsigned int n = 0, i;
+  char buf[1024];
+  FILE *fp;
 
-  for (i=0; i<16; i++) {
-    struct fs_stat *fs = &fs_stats[i];
+  fp = open_file(MOUNTINFO, &rep);
+  if (!fp) return;
 
-    if (fs->path && strcmp(fs->path, s) == 0)
-      return fs;
+  while (fgets(buf, sizeof(buf), fp) != NULL) {
+    /* id parent major:minor root mount_point options ... - type source ... */
+    char dir[512], type[64], dev[256];
+    char *sep;
+    int id;
 
-    if (fs->fd <= 0) {
-      /* when compiled with icc, it crashes when leaving function and open()
-       * is used, I don't know why */
-
-      /* this icc workaround didn't seem to work */
-#if 0
-      {
-        FILE *fp = fopen(s, "r");
-        if(fp)
-          fs->fd = fileno(fp);
-        else
-          fs->fd = -1;
-      }
-#endif
+    if (sscanf(buf, "%d %*d %*s %*s %511s", &id, dir) != 2)
+      continue;
 
-      fs->fd = open(s, O_RDONLY);
+    sep = strstr(buf, " - ");
+    if (!sep || sscanf(sep + 3, "%63s %255s", type, dev) != 2)
+      continue;
 
-      if (fs->fd <= 0) { /* 0 isn't error but actually it is :) */
-        ERR("open '%s': %s", s, strerror(errno));
-        return 0;
-      }
+    m = (struct fs_mount *) realloc(m, sizeof(struct fs_mount) * (n+1));
+    m[n].id = id;
+    m[n].dir = unescape_mount_field(dir);
+    m[n].type = strdup(type);
+    m[n].dev = unescape_mount_field(dev);
+    m[n].fs = NULL;
+    m[n].no_space = 0;
+    n++;
+  }
 
-      fs->path = strdup(s);
-      update_fs_stats();
-      return fs;
+  fclose(fp);
+
+  /* keep fs_stats of mounts that are still there */
+  for (i=0; i<fs_mount_count; i++) {
+    unsigned int j;
+
+    if (!fs_mounts[i].fs && !fs_mounts[i].no_space)
+      continue;
+
+    for (j=0; j<n; j++) {
+      if (m[j].id == fs_mounts[i].id && strcmp(m[j].dir, fs_mounts[i].dir) == 0) {
+        m[j].fs = fs_mounts[i].fs;
+        m[j].no_space = fs_mounts[i].no_space;
+        fs_mounts[i].fs = NULL;
+        break;
+      }
     }
   }
 
-  ERR("too many fs stats");
-  return 0;
+  free_fs_mounts(fs_mounts, fs_mount_count, 1);
+  fs_mounts = m;
+  fs_mount_count = n;
+}
+
+/* returns current mount table, the table is reread only when the kernel has
+ * told that it has changed (fs_stat of entries is made by caller with
+ * get_fs_mount_stat()) */
+unsigned int get_fs_mounts(struct fs_mount **mounts) {
+  if (fs_mounts_stale) {
+    fs_mounts_stale = 0;
+    read_fs_mounts();
+  }
+
+  *mounts = fs_mounts;
+  return fs_mount_count;
+}
+
+struct fs_stat *get_fs_mount_stat(struct fs_mount *m) {
+  if (m->fs == NULL && !m->no_space)
+    m->fs = prepare_fs_stat(m->dir);
+  return m->fs;
+}
+
+/* releases fs_stat of a mount that has nothing to show, it isn't made again
+ * while the mount exists */
+void drop_fs_mount_stat(struct fs_mount *m) {
+  if (m->fs) {
+    release_fs_stat(m->fs);
+    m->fs = NULL;
+  }
+  m->no_space = 1;
 }
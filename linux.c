@@ -9,6 +9,13 @@
 #include <sys/types.h>
 #include <sys/sysinfo.h>
 #include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/select.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/connector.h>
+#include <linux/cn_proc.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <assert.h>
@@ -61,52 +68,154 @@ void update_uptime() {
 #endif
 }
 
-/* these things are also in sysinfo except Buffers:, that's why I'm reading
- * them from proc */
+/* reads whole file, returns length or -1 */
+static int pread_file(int fd, char *buf, unsigned int size) {
+  int n;
+
+  if (fd < 0)
+    return -1;
+  n = pread(fd, buf, size - 1, 0);
+  if (n < 0)
+    return -1;
+  buf[n] = '\0';
+  return n;
+}
+
+/* pread_file() to malloc'd buffer that grows until whole file fits */
+static int pread_all(int fd, char **buf, unsigned int *size) {
+  int n;
+
+  if (*buf == NULL) {
+    *size = 16384;
+    *buf = (char *) malloc(*size);
+  }
+  while ((n = pread_file(fd, *buf, *size)) == (int) *size - 1) {
+    *size *= 2;
+    *buf = (char *) realloc(*buf, *size);
+  }
+  return n;
+}
+
+/* every field of /proc/meminfo in the order kernel prints them, lines are
+ * matched from where previous one was found so a pass is one compare per
+ * line, fields that kernel doesn't have are -1 */
+
+static const char *meminfo_keys[] = {
+  "MemTotal", "MemFree", "MemAvailable", "Buffers", "Cached", "SwapCached",
+  "Active", "Inactive", "Active(anon)", "Inactive(anon)", "Active(file)",
+  "Inactive(file)", "Unevictable", "Mlocked", "HighTotal", "HighFree",
+  "LowTotal", "LowFree", "MmapCopy", "SwapTotal", "SwapFree", "Zswap",
+  "Zswapped", "Dirty", "Writeback", "AnonPages", "Mapped", "Shmem",
+  "KReclaimable", "Slab", "SReclaimable", "SUnreclaim", "KernelStack",
+  "ShadowCallStack", "PageTables", "SecPageTables", "NFS_Unstable", "Bounce",
+  "WritebackTmp", "CommitLimit", "Committed_AS", "VmallocTotal",
+  "VmallocUsed", "VmallocChunk", "Percpu", "HardwareCorrupted",
+  "AnonHugePages", "ShmemHugePages", "ShmemPmdMapped", "FileHugePages",
+  "FilePmdMapped", "CmaTotal", "CmaFree", "Balloon", "Unaccepted",
+  "HugePages_Total", "HugePages_Free", "HugePages_Rsvd", "HugePages_Surp",
+  "Hugepagesize", "Hugetlb", "DirectMap4k", "DirectMap2M", "DirectMap4M",
+  "DirectMap1G", 0,
+};
+
+#define MEMINFO_KEYS (sizeof(meminfo_keys) / sizeof(meminfo_keys[0]) - 1)
+
+static long long meminfo_values[MEMINFO_KEYS];
+
+/* returns index of meminfo field or -1 */
+int get_meminfo_key(const char *name) {
+  int i;
+
+  for (i=0; meminfo_keys[i]; i++) {
+    if (strcmp(meminfo_keys[i], name) == 0)
+      return i;
+  }
 
-static FILE *meminfo_fp;
+  return -1;
+}
+
+/* HugePages_ fields are page counts, others kilobytes */
+int meminfo_is_count(int key) {
+  return strncmp(meminfo_keys[key], "HugePages_", 10) == 0;
+}
+
+static int meminfo_fd = -1;
 
 void update_meminfo() {
   static int rep;
-/*  unsigned int a; */
-  char buf[256];
+  char buf[4096];
+  char *l;
+  int i = 0;
+
+  static int swap_total = -1, swap_free;
+
+  if (swap_total < 0) {
+    swap_total = get_meminfo_key("SwapTotal");
+    swap_free = get_meminfo_key("SwapFree");
+  }
 
   info.mem = info.memmax = info.swap = info.swapmax = info.bufmem =
     info.buffers = info.cached = 0;
 
-  if (meminfo_fp == NULL)
-    meminfo_fp = open_file("/proc/meminfo", &rep);
-  else
-    fseek(meminfo_fp, 0, SEEK_SET);
-  if (meminfo_fp == NULL) return;
+  if (meminfo_fd < 0) {
+    meminfo_fd = open("/proc/meminfo", O_RDONLY | O_CLOEXEC);
+    if (meminfo_fd < 0) {
+      if (!rep) {
+        ERR("can't open /proc/meminfo: %s", strerror(errno));
+        rep = 1;
+      }
+      return;
+    }
+  }
+  if (pread_file(meminfo_fd, buf, 4096) <= 0) return;
 
-  while (!feof(meminfo_fp)) {
-    if (fgets(buf, 255, meminfo_fp) == NULL) break;
+  info.meminfo = meminfo_values;
+  for (i=0; i<(int) MEMINFO_KEYS; i++)
+    info.meminfo[i] = -1;
 
-    if (strncmp(buf, "MemTotal:", 9) == 0) {
-      sscanf(buf, "%*s %u", &info.memmax);
-    }
-    else if (strncmp(buf, "MemFree:", 8) == 0) {
-      sscanf(buf, "%*s %u", &info.mem);
-    }
-    else if (strncmp(buf, "SwapTotal:", 10) == 0) {
-      sscanf(buf, "%*s %u", &info.swapmax);
-    }
-    else if (strncmp(buf, "SwapFree:", 9) == 0) {
-      sscanf(buf, "%*s %u", &info.swap);
-    }
-    else if (strncmp(buf, "Buffers:", 8) == 0) {
-      sscanf(buf, "%*s %u", &info.buffers);
+  /* "Key:   value kB" */
+  i = 0;
+  for (l = buf; l && *l; l = strchr(l, '\n') ? strchr(l, '\n') + 1 : 0) {
+    char *colon = strchr(l, ':');
+    int j, len;
+
+    if (colon == NULL)
+      break;
+    len = colon - l;
+
+    for (j = i; meminfo_keys[j]; j++) {
+      if (strncmp(meminfo_keys[j], l, len) == 0 && meminfo_keys[j][len] == 0)
+        break;
     }
-    else if (strncmp(buf, "Cached:", 7) == 0) {
-      sscanf(buf, "%*s %u", &info.cached);
+    /* kernel may have moved something */
+    if (meminfo_keys[j] == 0) {
+      for (j = 0; j < i; j++) {
+        if (strncmp(meminfo_keys[j], l, len) == 0 &&
+            meminfo_keys[j][len] == 0)
+          break;
+      }
+      if (j == i)
+        continue;
     }
-  }
 
-  info.mem = info.memmax - info.mem;
-  info.swap = info.swapmax - info.swap;
+    info.meminfo[j] = strtoll(colon + 1, 0, 10);
+    i = j + 1;
+  }
 
-  info.bufmem = info.cached + info.buffers;
+  /* MemTotal, MemFree, MemAvailable, Buffers and Cached are first in
+   * meminfo_keys */
+  info.memmax = info.meminfo[0];
+  info.mem = info.memmax - info.meminfo[1];
+  info.buffers = info.meminfo[3];
+  info.cached = info.meminfo[4];
+  info.swapmax = info.meminfo[swap_total];
+  info.swap = info.swapmax - info.meminfo[swap_free];
+
+  /* MemAvailable (Linux 3.14) knows what can really be reclaimed, Buffers
+   * and Cached have shared memory in them */
+  if (info.meminfo[2] >= 0)
+    info.bufmem = info.meminfo[2] - info.meminfo[1];
+  else
+    info.bufmem = info.cached + info.buffers;
 
   info.mask |= (1 << INFO_MEM) | (1 << INFO_BUFFERS);
 }
@@ -190,11 +299,16 @@ static unsigned int cpu_user, cpu_system, cpu_nice;
 static double last_cpu_sum;
 static int clock_ticks;
 
+/* counters since boot */
+static unsigned long long ctxt, intr, forks;
+static unsigned long long last_ctxt, last_intr, last_forks;
+
 static FILE *stat_fp;
 
 static void update_stat() {
   static int rep;
   char buf[256];
+  int cont = 0;
 
   if (stat_fp == NULL)
     stat_fp = open_file("/proc/stat", &rep);
@@ -205,9 +319,16 @@ static void update_stat() {
   info.cpu_count = 0;
 
   while (!feof(stat_fp)) {
+    int skip = cont;
+
     if (fgets(buf, 255, stat_fp) == NULL)
       break;
 
+    /* intr line is longer than buf, skip the rest of it */
+    cont = strchr(buf, '\n') == NULL;
+    if (skip)
+      continue;
+
     if (strncmp(buf, "procs_running ", 14) == 0) {
       sscanf(buf, "%*s %d", &info.run_procs);
       info.mask |= (1 << INFO_RUN_PROCS);
@@ -219,7 +340,20 @@ static void update_stat() {
     else if (strncmp(buf, "cpu", 3) == 0 && isdigit(buf[3])) {
       info.cpu_count++;
     }
+    else if (strncmp(buf, "procs_blocked ", 14) == 0) {
+      sscanf(buf, "%*s %u", &info.procs_blocked);
+    }
+    else if (strncmp(buf, "ctxt ", 5) == 0) {
+      sscanf(buf, "%*s %Lu", &ctxt);
+    }
+    else if (strncmp(buf, "intr ", 5) == 0) {
+      sscanf(buf, "%*s %Lu", &intr);
+    }
+    else if (strncmp(buf, "processes ", 10) == 0) {
+      sscanf(buf, "%*s %Lu", &forks);
+    }
   }
+  info.mask |= (1 << INFO_STAT);
 
   {
     double delta;
@@ -232,6 +366,15 @@ static void update_stat() {
     info.cpu_usage = (cpu_user+cpu_nice+cpu_system - last_cpu_sum) / delta
       / (double) clock_ticks / info.cpu_count;
     last_cpu_sum = cpu_user+cpu_nice+cpu_system;
+
+    if (last_ctxt) {
+      info.ctxt_rate = (ctxt - last_ctxt) / delta;
+      info.intr_rate = (intr - last_intr) / delta;
+      info.fork_rate = (forks - last_forks) / delta;
+    }
+    last_ctxt = ctxt;
+    last_intr = intr;
+    last_forks = forks;
   }
 }
 
@@ -243,6 +386,10 @@ void update_cpu_usage() {
   update_stat();
 }
 
+void update_stat_counters() {
+  update_stat();
+}
+
 void update_load_average() {
 #ifdef HAVE_GETLOADAVG
   double v[3];
@@ -298,83 +445,216 @@ static int get_first_file_in_a_directory(const char *dir, char *s, int *rep) {
   }
 }
 
-#define I2C_DIR "/sys/bus/i2c/devices/"
+/* hwmon sensors
+ *
+ * /sys/class/hwmon is scanned once for *_input files of every chip, they
+ * are found by chip name and label (like coretemp "Package id 0") or by
+ * file (like temp1). Sensors that objects use are read once per update. */
 
-int open_i2c_sensor(const char *dev, const char *type, int n, int *div) {
-  char path[256];
-  char buf[64];
-  int fd;
-  int divfd;
+#define HWMON_DIR "/sys/class/hwmon"
+
+static struct hwmon_sensor *hwmon_sensors, *hwmon_last;
+static int hwmon_scanned;
+
+/* first line of a small sysfs file */
+static int read_sysfs_line(const char *path, char *buf, unsigned int size) {
+  int fd, n;
+
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return 0;
+  n = pread_file(fd, buf, size);
+  close(fd);
+  if (n <= 0)
+    return 0;
+
+  buf[strcspn(buf, "\n")] = '\0';
+  return 1;
+}
+
+static void scan_hwmon_chip(const char *hwmon) {
+  char path[256], chip[32], dev[32], link[256];
+  struct dirent *de;
+  DIR *dir;
+  int n;
+
+  snprintf(path, 256, HWMON_DIR "/%s/name", hwmon);
+  if (!read_sysfs_line(path, chip, sizeof(chip)))
+    return;
+
+  /* device is like 0-0290 for i2c chips */
+  dev[0] = '\0';
+  snprintf(path, 256, HWMON_DIR "/%s/device", hwmon);
+  n = readlink(path, link, 255);
+  if (n > 0) {
+    link[n] = '\0';
+    /* too long one couldn't be matched anyway */
+    if (snprintf(dev, 32, "%s", strrchr(link, '/') ? strrchr(link, '/') + 1 :
+          link) >= 32)
+      dev[0] = '\0';
+  }
+
+  snprintf(path, 256, HWMON_DIR "/%s", hwmon);
+  dir = opendir(path);
+  if (dir == NULL)
+    return;
+
+  while ((de = readdir(dir)) != NULL) {
+    struct hwmon_sensor *s;
+    char *input = strstr(de->d_name, "_input");
+
+    if (input == NULL || input[6] != '\0' || input == de->d_name ||
+        input - de->d_name >= 16)
+      continue;
+
+    s = (struct hwmon_sensor *) calloc(1, sizeof(struct hwmon_sensor));
+    /* cut path would be some other file */
+    if (snprintf(s->path, sizeof(s->path), "%s/%s", hwmon, de->d_name) >=
+        (int) sizeof(s->path)) {
+      free(s);
+      continue;
+    }
+    snprintf(s->chip, 32, "%s", chip);
+    snprintf(s->dev, 32, "%s", dev);
+    memcpy(s->file, de->d_name, input - de->d_name);
+    s->fd = -1;
+
+    snprintf(path, 256, HWMON_DIR "/%s/%s_label", hwmon, s->file);
+    if (!read_sysfs_line(path, s->label, sizeof(s->label)))
+      strcpy(s->label, s->file);
+
+    /* millidegrees, millivolts, milliamperes and microwatts */
+    if (strncmp(s->file, "power", 5) == 0 ||
+        strncmp(s->file, "energy", 6) == 0)
+      s->div = 1000000;
+    else if (strncmp(s->file, "fan", 3) == 0 ||
+        strncmp(s->file, "pwm", 3) == 0)
+      s->div = 1;
+    else
+      s->div = 1000;
+
+    if (hwmon_last)
+      hwmon_last->next = s;
+    else
+      hwmon_sensors = s;
+    hwmon_last = s;
+  }
+
+  closedir(dir);
+}
+
+/* in order so that i2c without device gets the same chip every time */
+static void scan_hwmon() {
+  static int rep;
+  struct dirent **namelist;
+  int i, n;
+
+  hwmon_scanned = 1;
+
+  n = scandir(HWMON_DIR, &namelist, no_dots, alphasort);
+  if (n < 0) {
+    if (!rep) {
+      ERR("scandir for " HWMON_DIR ": %s", strerror(errno));
+      rep = 1;
+    }
+    return;
+  }
 
-  /* if i2c device is NULL or *, get first */
-  if (dev == NULL || strcmp(dev, "*") == 0) {
-    static int rep;
-    if (!get_first_file_in_a_directory(I2C_DIR, buf, &rep))
-      return -1;
-    dev = buf;
+  for (i=0; i<n; i++) {
+    scan_hwmon_chip(namelist[i]->d_name);
+    free(namelist[i]);
   }
+  free(namelist);
+}
+
+static struct hwmon_sensor *use_hwmon_sensor(struct hwmon_sensor *s) {
+  char path[128];
+
+  if (s->fd < 0) {
+    snprintf(path, 128, HWMON_DIR "/%s", s->path);
+    s->fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (s->fd < 0)
+      ERR("can't open '%s': %s", path, strerror(errno));
+  }
+  s->used = 1;
+  return s;
+}
+
+struct hwmon_sensor *get_hwmon_sensor(const char *chip, const char *label) {
+  struct hwmon_sensor *s;
+
+  if (!hwmon_scanned)
+    scan_hwmon();
+
+  /* label first, then file */
+  for (s = hwmon_sensors; s; s = s->next) {
+    if (strcmp(s->chip, chip) == 0 && strcmp(s->label, label) == 0)
+      return use_hwmon_sensor(s);
+  }
+  for (s = hwmon_sensors; s; s = s->next) {
+    if (strcmp(s->chip, chip) == 0 && strcmp(s->file, label) == 0)
+      return use_hwmon_sensor(s);
+  }
+
+  ERR("hwmon sensor '%s' of '%s' not found", label, chip);
+  return 0;
+}
+
+/* ${i2c (dev) type n}, dev is i2c device or chip name, if NULL or * any
+ * chip that has the sensor */
+struct hwmon_sensor *get_i2c_sensor(const char *dev, const char *type, int n) {
+  struct hwmon_sensor *s;
+  char file[16];
+
+  if (!hwmon_scanned)
+    scan_hwmon();
 
   /* change vol to in */
   if (strcmp(type, "vol") == 0)
     type = "in";
+  snprintf(file, 16, "%s%d", type, n);
 
-  snprintf(path, 255, I2C_DIR "%s/%s%d_input", dev, type, n);
+  if (dev && strcmp(dev, "*") == 0)
+    dev = NULL;
 
-  /* open file */
-  fd = open(path, O_RDONLY);
-  if (fd < 0) ERR("can't open '%s': %s", path, strerror(errno));
+  for (s = hwmon_sensors; s; s = s->next) {
+    if (strcmp(s->file, file) == 0 && (dev == NULL ||
+          strcmp(s->dev, dev) == 0 || strcmp(s->chip, dev) == 0))
+      return use_hwmon_sensor(s);
+  }
 
-  if (strcmp(type, "in") == 0 || strcmp(type, "temp") == 0)
-    *div = 1;
-  else
-    *div = 0;
+  ERR("i2c sensor %s of '%s' not found", file, dev ? dev : "*");
+  return 0;
+}
 
-  /* test if *_div file exist, open it and use it as divisor */
-  snprintf(path, 255, I2C_DIR "%s/%s%d_div", dev, type, n);
+void clear_hwmon() {
+  while (hwmon_sensors) {
+    struct hwmon_sensor *s = hwmon_sensors;
 
-  divfd = open(path, O_RDONLY);
-  if (divfd > 0) {
-    /* read integer */
-    char divbuf[64];
-    unsigned int divn;
-    divn = read(divfd, divbuf, 63);
-    /* should read until n == 0 but I doubt that kernel will give these
-     * in multiple pieces. :) */
-    divbuf[divn] = '\0';
-    *div = atoi(divbuf);
+    hwmon_sensors = s->next;
+    if (s->fd >= 0)
+      close(s->fd);
+    free(s);
   }
-
-  close(divfd);
-
-  return fd;
+  hwmon_last = NULL;
+  hwmon_scanned = 0;
 }
 
-double get_i2c_info(int fd, int div) {
-  int val = 0;
+void update_hwmon() {
+  struct hwmon_sensor *s;
+  char buf[32];
 
-  if (fd <= 0) return 0;
+  for (s = hwmon_sensors; s; s = s->next) {
+    if (!s->used)
+      continue;
 
-  lseek(fd, 0, SEEK_SET);
+    if (pread_file(s->fd, buf, sizeof(buf)) > 0)
+      s->value = strtod(buf, 0) / s->div;
+    else
+      s->value = 0;
+  }
 
-  /* read integer */
-  {
-    char buf[64];
-    unsigned int n;
-    n = read(fd, buf, 63);
-    /* should read until n == 0 but I doubt that kernel will give these
-     * in multiple pieces. :) */
-    buf[n] = '\0';
-    val = atoi(buf);
-  }
-
-  /* divide voltage and temperature by 1000 */
-  /* or if any other divisor is given, use that */ 
-  if (div > 1)
-    return val / div;
-  else if (div)
-    return val / 1000.0;
-  else
-    return val;
+  info.mask |= (1 << INFO_I2C);
 }
 
 #define ADT746X_FAN "/sys/devices/temperatures/cpu_fan_speed"
@@ -415,37 +695,16 @@ char* get_adt746x_cpu() {
   }
 
   fp = open_file(ADT746X_CPU, &rep);
+  if (!fp) {
+    strcpy(adt746x_cpu_state, "??");
+    return adt746x_cpu_state;
+  }
   fscanf(fp, "%2s", adt746x_cpu_state);
   fclose(fp);
 
   return adt746x_cpu_state;
 }
 
-static char *frequency;
-
-char* get_freq()
-{
-    FILE *f;
-    char s[1000];
-    if (frequency == NULL) {
-    	frequency = (char*)malloc(100);
-    	assert(frequency!=NULL);
-    }
-    //char frequency[10];
-    f=fopen("/proc/cpuinfo","r"); //open the CPU information file
-    //if (!f)
-    //    return;
-    while (fgets(s,1000,f)!=NULL)  //read the file
-        if ( strncmp(s, "cpu M", 5)==0 ) { //and search for the cpu mhz
-                //printf("%s", strchr(s, ':')+2);
-                strcpy(frequency,strchr(s, ':')+2); //copy just the number
-                frequency[strlen(frequency)-1] = '\0'; // strip \n
-                break;
-        }
-    fclose(f);
-    return frequency;
-}
-
 #define ACPI_FAN_DIR "/proc/acpi/fan/"
 
 static char *acpi_fan_state;
@@ -473,6 +732,7 @@ char* get_acpi_fan() {
     return acpi_fan_state;
   }
   fscanf(fp, "%*s %99s", acpi_fan_state);
+  fclose(fp);
 
   return acpi_fan_state;
 }
@@ -523,232 +783,2744 @@ critical (S5):           73 C
 passive:                 73 C: tc1=4 tc2=3 tsp=40 devices=0xcdf6e6c0
 */
 
-#define ACPI_THERMAL_DIR "/proc/acpi/thermal_zone/"
-#define ACPI_THERMAL_FORMAT "/proc/acpi/thermal_zone/%s/temperature"
+/* thermal zones and cooling devices
+ *
+ * /sys/class/thermal is scanned once, zones and devices that objects use
+ * have their own fd and are read once per update */
 
-int open_acpi_temperature(const char *name) {
+#define THERMAL_DIR "/sys/class/thermal"
+
+static struct thermal_dev *thermal_devs, *thermal_last;
+static int thermal_scanned;
+static int thermal_max_used;
+
+static void scan_thermal() {
+  static int rep;
+  struct dirent **namelist;
   char path[256];
-  char buf[64];
-  int fd;
+  int i, n;
+
+  thermal_scanned = 1;
 
-  if (name == NULL || strcmp(name, "*") == 0) {
-    static int rep;
-    if (!get_first_file_in_a_directory(ACPI_THERMAL_DIR, buf, &rep))
-      return -1;
-    name = buf;
+  n = scandir(THERMAL_DIR, &namelist, no_dots, alphasort);
+  if (n < 0) {
+    if (!rep) {
+      ERR("scandir for " THERMAL_DIR ": %s", strerror(errno));
+      rep = 1;
+    }
+    return;
   }
 
-  snprintf(path, 255, ACPI_THERMAL_FORMAT, name);
+  for (i=0; i<n; i++) {
+    struct thermal_dev *t;
+    int num, cooling;
+    char buf[32];
 
-  fd = open(path, O_RDONLY);
-  if (fd < 0) ERR("can't open '%s': %s", path, strerror(errno));
+    if (sscanf(namelist[i]->d_name, "thermal_zone%d", &num) == 1)
+      cooling = 0;
+    else if (sscanf(namelist[i]->d_name, "cooling_device%d", &num) == 1)
+      cooling = 1;
+    else {
+      free(namelist[i]);
+      continue;
+    }
 
-  return fd;
+    t = (struct thermal_dev *) calloc(1, sizeof(struct thermal_dev));
+    if (snprintf(t->dir, 32, "%s", namelist[i]->d_name) >= 32) {
+      free(t);
+      free(namelist[i]);
+      continue;
+    }
+    t->num = num;
+    t->cooling = cooling;
+    t->fd = -1;
+
+    snprintf(path, 256, THERMAL_DIR "/%s/type", t->dir);
+    read_sysfs_line(path, t->type, sizeof(t->type));
+    if (cooling) {
+      snprintf(path, 256, THERMAL_DIR "/%s/max_state", t->dir);
+      if (read_sysfs_line(path, buf, sizeof(buf)))
+        t->max_state = atoi(buf);
+    }
+
+    if (thermal_last)
+      thermal_last->next = t;
+    else
+      thermal_devs = t;
+    thermal_last = t;
+
+    free(namelist[i]);
+  }
+  free(namelist);
 }
 
-static double last_acpi_temp;
-static double last_acpi_temp_time;
+static void open_thermal_dev(struct thermal_dev *t) {
+  char path[128];
+
+  if (t->fd >= 0)
+    return;
+
+  snprintf(path, 128, THERMAL_DIR "/%s/%s", t->dir,
+      t->cooling ? "cur_state" : "temp");
+  t->fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (t->fd < 0)
+    ERR("can't open '%s': %s", path, strerror(errno));
+}
 
-double get_acpi_temperature(int fd) {
-  if (fd <= 0) return 0;
+/* name is number, directory (thermal_zone0) or type (x86_pkg_temp), first
+ * one if NULL or * */
+static struct thermal_dev *find_thermal_dev(const char *name, int cooling) {
+  struct thermal_dev *t;
+  char *end;
+  int num = -1;
+
+  if (!thermal_scanned)
+    scan_thermal();
+
+  if (name && strcmp(name, "*") == 0)
+    name = NULL;
+  if (name) {
+    num = strtol(name, &end, 10);
+    if (*end != '\0')
+      num = -1;
+  }
 
-  /* don't update acpi temperature too often */
-  if (current_update_time - last_acpi_temp_time < 11.32) {
-    return last_acpi_temp;
+  for (t = thermal_devs; t; t = t->next) {
+    if (t->cooling != cooling)
+      continue;
+    if (name == NULL || t->num == num || strcmp(t->dir, name) == 0 ||
+        strcmp(t->type, name) == 0) {
+      open_thermal_dev(t);
+      t->used = 1;
+      return t;
+    }
   }
-  last_acpi_temp_time = current_update_time;
 
-  /* seek to beginning */
-  lseek(fd, 0, SEEK_SET);
+  ERR("%s '%s' not found", cooling ? "cooling device" : "thermal zone",
+      name ? name : "*");
+  return 0;
+}
 
-  /* read */
-  {
-    char buf[256];
-    int n;
-    n = read(fd, buf, 255);
-    if (n < 0) ERR("can't read fd %d: %s", fd, strerror(errno));
+struct thermal_dev *get_thermal_zone(const char *name) {
+  return find_thermal_dev(name, 0);
+}
+
+struct thermal_dev *get_cooling_device(const char *name) {
+  return find_thermal_dev(name, 1);
+}
+
+void use_all_thermal_zones() {
+  struct thermal_dev *t;
+
+  if (!thermal_scanned)
+    scan_thermal();
+
+  for (t = thermal_devs; t; t = t->next) {
+    if (!t->cooling)
+      open_thermal_dev(t);
+  }
+  thermal_max_used = 1;
+}
+
+void clear_thermal() {
+  while (thermal_devs) {
+    struct thermal_dev *t = thermal_devs;
+
+    thermal_devs = t->next;
+    if (t->fd >= 0)
+      close(t->fd);
+    free(t);
+  }
+  thermal_last = NULL;
+  thermal_scanned = 0;
+  thermal_max_used = 0;
+}
+
+void update_thermal() {
+  struct thermal_dev *t;
+  double max = 0;
+  int have_max = 0;
+  char buf[32];
+
+  for (t = thermal_devs; t; t = t->next) {
+    if (!t->used && (t->cooling || !thermal_max_used))
+      continue;
+
+    /* some zones give error when sensor isn't ready */
+    if (pread_file(t->fd, buf, sizeof(buf)) <= 0) {
+      t->valid = 0;
+      continue;
+    }
+    t->valid = 1;
+
+    if (t->cooling)
+      t->value = atoi(buf);
     else {
-      buf[n] = '\0';
-      sscanf(buf, "temperature: %lf", &last_acpi_temp);
+      /* millidegrees */
+      t->value = atoi(buf) / 1000.0;
+      if (!have_max || t->value > max)
+        max = t->value;
+      have_max = 1;
     }
   }
 
-  return last_acpi_temp;
+  info.thermal_max = max;
+  info.mask |= (1 << INFO_THERMAL);
 }
 
-/*
-hipo@lepakko hipo $ cat /proc/acpi/battery/BAT1/info 
-present:                 yes
-design capacity:         4400 mAh
-last full capacity:      4064 mAh
-battery technology:      rechargeable
-design voltage:          14800 mV
-design capacity warning: 300 mAh
-design capacity low:     200 mAh
-capacity granularity 1:  32 mAh
-capacity granularity 2:  32 mAh
-model number:            02KT
-serial number:           16922
-battery type:            LION
-OEM info:                SANYO
-*/
-
-/*
-hipo@lepakko torsmo $ cat /proc/acpi/battery/BAT1/state
-present:                 yes
-capacity state:          ok
-charging state:          unknown
-present rate:            0 mA
-remaining capacity:      4064 mAh
-present voltage:         16608 mV
-*/
+/* acpitemp is thermal zone, returns number of it */
+int open_acpi_temperature(const char *name) {
+  struct thermal_dev *t = get_thermal_zone(name);
 
-/*
-2213<@jupetkellari> jupet@lagi-unstable:~$ cat /proc/apm 
-2213<@jupetkellari> 1.16 1.2 0x03 0x01 0xff 0x10 -1% -1 ?
-2213<@jupetkellari> (-1 ollee ei akkua kiinni, koska akku on pydll)
-2214<@jupetkellari> jupet@lagi-unstable:~$ cat /proc/apm 
-2214<@jupetkellari> 1.16 1.2 0x03 0x01 0x03 0x09 98% -1 ?
+  return t ? t->num : -1;
+}
 
-2238<@jupetkellari> 1.16 1.2 0x03 0x00 0x00 0x01 100% -1 ? ilman verkkovirtaa
-2239<@jupetkellari> 1.16 1.2 0x03 0x01 0x00 0x01 99% -1 ? verkkovirralla
+double get_acpi_temperature(int num) {
+  struct thermal_dev *t;
 
-2240<@jupetkellari> 1.16 1.2 0x03 0x01 0x03 0x09 100% -1 ? verkkovirralla ja monitori pll
-2241<@jupetkellari> 1.16 1.2 0x03 0x00 0x00 0x01 99% -1 ? monitori pll mutta ilman verkkovirtaa
-*/
+  for (t = thermal_devs; t; t = t->next) {
+    if (!t->cooling && t->num == num)
+      return t->value;
+  }
+  return 0;
+}
 
-#define ACPI_BATTERY_BASE_PATH "/proc/acpi/battery"
-#define APM_PATH "/proc/apm"
+/* power supplies
+ *
+ * /sys/class/power_supply is scanned once, every used supply has its
+ * uevent open and it is read with one pread() per update. Power of
+ * batteries is smoothed for time estimates. */
 
-static FILE *acpi_bat_fp;
-static FILE *apm_bat_fp;
+#define POWER_SUPPLY_DIR "/sys/class/power_supply"
 
-static int acpi_last_full;
+/* seconds, how long it takes for power to follow a change */
+#define POWER_SMOOTHING 60.0
 
-static char last_battery_str[64];
+static struct power_supply *power_supplies, *power_supplies_last;
+static int power_supplies_scanned;
+static double last_power_update;
 
-static double last_battery_time;
+static void scan_power_supplies() {
+  static int rep;
+  struct dirent **namelist;
+  char path[256], type[16];
+  int i, n;
 
-void get_battery_stuff(char *buf, unsigned int n, const char *bat) {
-  static int rep, rep2;
-  char acpi_path[128];
-  snprintf(acpi_path, 127, ACPI_BATTERY_BASE_PATH "/%s/state", bat);
+  power_supplies_scanned = 1;
 
-  /* don't update battery too often */
-  if (current_update_time - last_battery_time < 29.5) {
-    snprintf(buf, n, "%s", last_battery_str);
+  n = scandir(POWER_SUPPLY_DIR, &namelist, no_dots, alphasort);
+  if (n < 0) {
+    if (!rep) {
+      ERR("scandir for " POWER_SUPPLY_DIR ": %s", strerror(errno));
+      rep = 1;
+    }
     return;
   }
-  last_battery_time = current_update_time;
 
-  /* first try ACPI */
+  for (i=0; i<n; i++) {
+    struct power_supply *s;
+
+    s = (struct power_supply *) calloc(1, sizeof(struct power_supply));
+    /* cut name would lead to some other directory */
+    if (snprintf(s->name, 32, "%s", namelist[i]->d_name) >= 32) {
+      free(s);
+      free(namelist[i]);
+      continue;
+    }
+    s->fd = -1;
 
-  if (acpi_bat_fp == NULL && apm_bat_fp == NULL)
-    acpi_bat_fp = open_file(acpi_path, &rep);
+    snprintf(path, 256, POWER_SUPPLY_DIR "/%s/type", s->name);
+    if (read_sysfs_line(path, type, sizeof(type)))
+      s->battery = strcmp(type, "Battery") == 0;
 
-  if (acpi_bat_fp != NULL) {
-    int present_rate = -1;
-    int remaining_capacity = -1;
-    char charging_state[64];
+    if (power_supplies_last)
+      power_supplies_last->next = s;
+    else
+      power_supplies = s;
+    power_supplies_last = s;
 
-    /* read last full capacity if it's zero */
-    if (acpi_last_full == 0) {
-      static int rep;
-      char path[128];
-      FILE *fp;
-      snprintf(path, 127, ACPI_BATTERY_BASE_PATH "/%s/info", bat);
-      fp = open_file(path, &rep);
-      if (fp != NULL) {
-        while (!feof(fp)) {
-          char b[256];
-          if (fgets(b, 256, fp) == NULL) break;
+    free(namelist[i]);
+  }
+  free(namelist);
+}
 
-          if (sscanf(b, "last full capacity: %d", &acpi_last_full) != 0)
-            break;
-        }
+static void open_power_supply(struct power_supply *s) {
+  char path[256];
 
-        fclose(fp);
-      }
-    }
+  s->used = 1;
+  if (s->fd >= 0)
+    return;
 
-    fseek(acpi_bat_fp, 0, SEEK_SET);
+  snprintf(path, 256, POWER_SUPPLY_DIR "/%s/uevent", s->name);
+  s->fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (s->fd < 0)
+    ERR("can't open '%s': %s", path, strerror(errno));
+}
 
-    strcpy(charging_state, "unknown");
+struct power_supply *get_power_supply(const char *name) {
+  struct power_supply *s;
 
-    while (!feof(acpi_bat_fp)) {
-      char buf[256];
-      if (fgets(buf, 256, acpi_bat_fp) == NULL) break;
+  if (!power_supplies_scanned)
+    scan_power_supplies();
 
-      /* let's just hope units are ok */
-      if(buf[0] == 'c')
-        sscanf(buf, "charging state: %63s", charging_state);
-      else if(buf[0] == 'p')
-        sscanf(buf, "present rate: %d", &present_rate);
-      else if(buf[0] == 'r')
-        sscanf(buf, "remaining capacity: %d", &remaining_capacity);
+  for (s = power_supplies; s; s = s->next) {
+    if (strcmp(s->name, name) == 0) {
+      open_power_supply(s);
+      return s;
     }
+  }
 
-    /* charging */
-    if (strcmp(charging_state, "charging") == 0) {
-      if (acpi_last_full != 0 && present_rate > 0) {
-        strcpy(last_battery_str, "charging ");
-        format_seconds(last_battery_str+9, 63-9,
-            (acpi_last_full - remaining_capacity) * 60 * 60 / present_rate);
-      }
-      else if (acpi_last_full != 0 && present_rate <= 0) {
-        sprintf(last_battery_str, "charging %d%%",
-            remaining_capacity * 100 / acpi_last_full);
-      }
-      else {
-        strcpy(last_battery_str, "charging");
-      }
+  ERR("power supply '%s' not found", name);
+  return 0;
+}
+
+/* for battery_total_percent, power_draw_w, ac_online and battery_time */
+void use_all_power_supplies() {
+  struct power_supply *s;
+
+  if (!power_supplies_scanned)
+    scan_power_supplies();
+
+  for (s = power_supplies; s; s = s->next)
+    open_power_supply(s);
+}
+
+void clear_power_supplies() {
+  while (power_supplies) {
+    struct power_supply *s = power_supplies;
+
+    power_supplies = s->next;
+    if (s->fd >= 0)
+      close(s->fd);
+    free(s);
+  }
+  power_supplies_last = NULL;
+  power_supplies_scanned = 0;
+}
+
+static long long abs_ll(long long v) {
+  return v < 0 ? -v : v;
+}
+
+static void read_power_supply(struct power_supply *s, double delta) {
+  long long energy_now = -1, energy_full = -1, charge_now = -1;
+  long long charge_full = -1, power_now = -1, current_now = -1;
+  long long voltage_now = -1;
+  char buf[4096], *l;
+  double power;
+
+  if (pread_file(s->fd, buf, sizeof(buf)) <= 0) {
+    s->valid = 0;
+    return;
+  }
+
+  s->capacity = -1;
+  s->online = 0;
+  s->device = 0;
+  strcpy(s->status, "Unknown");
+
+  /* POWER_SUPPLY_KEY=value */
+  for (l = buf; l; l = strchr(l, '\n') ? strchr(l, '\n') + 1 : 0) {
+    char *v;
+
+    if (strncmp(l, "POWER_SUPPLY_", 13) != 0 || (v = strchr(l, '=')) == 0)
+      continue;
+    l += 13;
+    v++;
+
+    if (strncmp(l, "STATUS=", 7) == 0)
+      snprintf(s->status, 16, "%.*s", (int) strcspn(v, "\n"), v);
+    else if (strncmp(l, "ONLINE=", 7) == 0)
+      s->online = atoi(v);
+    else if (strncmp(l, "SCOPE=", 6) == 0)
+      s->device = strncmp(v, "Device", 6) == 0;
+    else if (strncmp(l, "CAPACITY=", 9) == 0)
+      s->capacity = atoi(v);
+    else if (strncmp(l, "ENERGY_NOW=", 11) == 0)
+      energy_now = strtoll(v, 0, 10);
+    else if (strncmp(l, "ENERGY_FULL=", 12) == 0)
+      energy_full = strtoll(v, 0, 10);
+    else if (strncmp(l, "CHARGE_NOW=", 11) == 0)
+      charge_now = strtoll(v, 0, 10);
+    else if (strncmp(l, "CHARGE_FULL=", 12) == 0)
+      charge_full = strtoll(v, 0, 10);
+    else if (strncmp(l, "POWER_NOW=", 10) == 0)
+      power_now = abs_ll(strtoll(v, 0, 10));
+    else if (strncmp(l, "CURRENT_NOW=", 12) == 0)
+      current_now = abs_ll(strtoll(v, 0, 10));
+    else if (strncmp(l, "VOLTAGE_NOW=", 12) == 0)
+      voltage_now = strtoll(v, 0, 10);
+  }
+
+  s->valid = 1;
+  if (!s->battery)
+    return;
+
+  /* uWh, or uAh and uV */
+  if (energy_now >= 0 && energy_full > 0) {
+    s->energy = energy_now / 1000000.0;
+    s->energy_full = energy_full / 1000000.0;
+  }
+  else if (charge_now >= 0 && charge_full > 0 && voltage_now > 0) {
+    s->energy = charge_now * (voltage_now / 1000000.0) / 1000000.0;
+    s->energy_full = charge_full * (voltage_now / 1000000.0) / 1000000.0;
+  }
+  else
+    s->energy = s->energy_full = 0;
+
+  if (s->capacity < 0 && s->energy_full > 0)
+    s->capacity = s->energy * 100 / s->energy_full;
+
+  if (power_now >= 0)
+    power = power_now / 1000000.0;
+  else if (current_now >= 0 && voltage_now > 0)
+    power = current_now * (voltage_now / 1000000.0) / 1000000.0;
+  else
+    power = 0;
+
+  s->power = power;
+  if (s->power_avg == 0 || delta <= 0)
+    s->power_avg = power;
+  else
+    s->power_avg += (power - s->power_avg) * delta / (delta + POWER_SMOOTHING);
+}
+
+/* seconds to empty or full, -1 if not known */
+int power_supply_time(struct power_supply *s) {
+  if (s == NULL || !s->valid || s->power_avg <= 0.01 || s->energy_full <= 0)
+    return -1;
+
+  if (strcmp(s->status, "Discharging") == 0)
+    return s->energy / s->power_avg * 3600;
+  if (strcmp(s->status, "Charging") == 0)
+    return (s->energy_full - s->energy) / s->power_avg * 3600;
+  return -1;
+}
+
+void update_power_supplies() {
+  struct power_supply *s;
+  double delta, energy = 0, energy_full = 0, draw = 0, draw_avg = 0;
+  int capacity = 0, batteries = 0;
+
+  delta = current_update_time - last_power_update;
+  last_power_update = current_update_time;
+
+  info.ac_online = 0;
+
+  for (s = power_supplies; s; s = s->next) {
+    if (!s->used)
+      continue;
+
+    read_power_supply(s, delta);
+    /* batteries of mice and such don't power the computer */
+    if (!s->valid || s->device)
+      continue;
+
+    if (!s->battery) {
+      if (s->online)
+        info.ac_online = 1;
+      continue;
     }
-    /* discharging */
-    else if (strcmp(charging_state, "discharging") == 0) {
-      if (present_rate > 0)
-        format_seconds(last_battery_str, 63,
-            (remaining_capacity * 60 * 60) / present_rate);
-      else
-        sprintf(last_battery_str, "discharging %d%%",
-            remaining_capacity * 100 / acpi_last_full);
+
+    energy += s->energy;
+    energy_full += s->energy_full;
+    if (s->capacity >= 0) {
+      capacity += s->capacity;
+      batteries++;
     }
-    /* unknown, probably full / AC */
-    else {
-      if (acpi_last_full != 0 && remaining_capacity != acpi_last_full)
-        sprintf(last_battery_str, "unknown %d%%",
-            remaining_capacity * 100 / acpi_last_full);
-      else
-        strcpy(last_battery_str, "AC");
+    if (strcmp(s->status, "Discharging") == 0) {
+      draw += s->power;
+      draw_avg += s->power_avg;
     }
   }
-  else {
-    /* APM */
-    if (apm_bat_fp == NULL)
-      apm_bat_fp = open_file(APM_PATH, &rep2);
 
-    if (apm_bat_fp != NULL) {
-      int ac, status, flag, life;
+  /* by energy so that small battery doesn't count as much as big one */
+  if (energy_full > 0)
+    info.battery_total_percent = energy * 100 / energy_full;
+  else
+    info.battery_total_percent = batteries ? capacity / batteries : -1;
 
-      fscanf(apm_bat_fp, "%*s %*s %*x %x   %x       %x     %d%%",
-                                      &ac, &status, &flag, &life);
+  info.power_draw = draw;
+  info.battery_time = draw_avg > 0.01 ? energy / draw_avg * 3600 : -1;
 
-      if (life == -1) {
-        /* could check now that there is ac */
-        snprintf(last_battery_str, 64, "AC");
-      }
-      else if (ac && life != 100) { /* could check that status==3 here? */
-        snprintf(last_battery_str, 64, "charging %d%%", life);
-      }
-      else {
-        snprintf(last_battery_str, 64, "%d%%", life);
-      }
+  info.mask |= (1 << INFO_POWER);
+}
+
+void get_battery_stuff(char *buf, unsigned int n, const char *bat) {
+  struct power_supply *s;
+  char t[64], percent[16] = "";
+  int secs;
+
+  for (s = power_supplies; s; s = s->next) {
+    if (strcmp(s->name, bat) == 0)
+      break;
+  }
+  if (s == NULL || !s->valid) {
+    buf[0] = '\0';
+    return;
+  }
+
+  secs = power_supply_time(s);
+  if (secs >= 0)
+    format_seconds(t, 64, secs);
+  if (s->capacity >= 0)
+    snprintf(percent, 16, " %d%%", s->capacity);
+
+  if (strcmp(s->status, "Charging") == 0) {
+    if (secs >= 0)
+      snprintf(buf, n, "charging %s", t);
+    else
+      snprintf(buf, n, "charging%s", percent);
+  }
+  else if (strcmp(s->status, "Discharging") == 0) {
+    if (secs >= 0)
+      snprintf(buf, n, "%s", t);
+    else
+      snprintf(buf, n, "discharging%s", percent);
+  }
+  /* full or not charging, probably AC */
+  else if (strcmp(s->status, "Full") == 0 || s->capacity >= 100)
+    snprintf(buf, n, "AC");
+  else
+    snprintf(buf, n, "unknown%s", percent);
+}
+
+/* top processes
+ *
+ * /proc is read with getdents64() from directory that is kept open. Stat
+ * files of known processes are kept open above FD_SETSIZE, so that they
+ * don't get in the way of select(), and read again with pread(). Processes
+ * are in hash table by pid, start time tells if pid has been reused. Only
+ * MAX_TOP biggest are kept in min-heaps, nothing gets sorted. */
+
+struct proc_entry {
+  int pid;
+  unsigned long long starttime;
+  unsigned long long ticks;     /* utime + stime */
+  unsigned int seen;            /* generation of last scan */
+  int fd;                       /* open stat or -1 */
+  float cpu, mem;
+  char name[16];
+  struct proc_entry *next;
+};
+
+#define PROC_HASH 4096
+
+static struct proc_entry *proc_hash[PROC_HASH];
+static unsigned int proc_generation;
+static int proc_dir_fd = -1;
+static char *proc_dents;        /* getdents64() buffer for /proc */
+static int proc_open_fds, proc_fd_limit = -1;
+static double last_top_update;
+
+static int open_proc_dir() {
+  static int rep;
+
+  if (proc_dir_fd >= 0)
+    return 1;
+
+  proc_dir_fd = open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (proc_dir_fd < 0) {
+    if (!rep) {
+      ERR("can't open /proc: %s", strerror(errno));
+      rep = 1;
+    }
+    return 0;
+  }
+
+  proc_dents = (char *) malloc(65536);
+  return 1;
+}
+
+/* stat fd is moved above select()able fds if there's room for it */
+static int keep_proc_fd(int fd) {
+  int n;
+
+  if (proc_fd_limit < 0) {
+    /* use what we are allowed to */
+    unsigned long limit = raise_fd_limit(FD_SETSIZE + 65536);
+
+    if (limit > FD_SETSIZE + 65536)
+      limit = FD_SETSIZE + 65536;
+    proc_fd_limit = limit > FD_SETSIZE + 256 ? limit - FD_SETSIZE - 256 : 0;
+  }
+
+  if (proc_open_fds >= proc_fd_limit)
+    return -1;
+
+  n = fcntl(fd, F_DUPFD_CLOEXEC, FD_SETSIZE);
+  if (n >= 0)
+    proc_open_fds++;
+  return n;
+}
+
+/* closes fd that may have come from keep_proc_fd(), only those are counted
+ * and they are the ones above FD_SETSIZE (fds left where open() put them are
+ * below it as long as select() works at all) */
+static void release_proc_fd(int fd) {
+  if (fd < 0)
+    return;
+  if (fd >= FD_SETSIZE)
+    proc_open_fds--;
+  close(fd);
+}
+
+static void free_proc_entry(struct proc_entry *p) {
+  if (p->fd >= 0) {
+    close(p->fd);
+    proc_open_fds--;
+  }
+  free(p);
+}
+
+/* reads stat of process, returns 0 if process is gone */
+static int read_proc_stat(struct proc_entry *p, char *buf, unsigned int size) {
+  char path[32];
+  int n = -1;
+
+  if (p->fd >= 0) {
+    n = pread(p->fd, buf, size - 1, 0);
+    if (n <= 0) {
+      /* process has died, pid may be reused */
+      close(p->fd);
+      proc_open_fds--;
+      p->fd = -1;
+    }
+  }
+
+  if (p->fd < 0) {
+    int fd;
+
+    snprintf(path, 32, "%d/stat", p->pid);
+    fd = openat(proc_dir_fd, path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+      return 0;
+
+    n = pread(fd, buf, size - 1, 0);
+
+    p->fd = keep_proc_fd(fd);
+    close(fd);
+  }
+
+  if (n <= 0)
+    return 0;
+
+  buf[n] = '\0';
+  return 1;
+}
+
+/* fields of /proc/PID/stat that are used */
+struct proc_stat {
+  char name[16];
+  unsigned long long ticks;     /* utime + stime */
+  unsigned long long starttime;
+  int threads;
+  long rss;                     /* pages */
+};
+
+/* "pid (comm) state ..." fields after comm are numbered from 3 like in
+ * proc(5), comm may have spaces and parentheses */
+static int parse_proc_stat(char *buf, struct proc_stat *st) {
+  char *s, *e;
+  int i;
+
+  s = strchr(buf, '(');
+  e = strrchr(buf, ')');
+  if (s == NULL || e == NULL || e < s)
+    return 0;
+
+  *e = '\0';
+  snprintf(st->name, 16, "%s", s + 1);
+
+  st->ticks = 0;
+  s = e + 2;
+  for (i = 3; i <= 24 && *s; i++) {
+    switch (i) {
+    case 14: /* utime */
+    case 15: /* stime */
+      st->ticks += strtoull(s, 0, 10);
+      break;
+    case 20:
+      st->threads = atoi(s);
+      break;
+    case 22:
+      st->starttime = strtoull(s, 0, 10);
+      break;
+    case 24:
+      st->rss = strtol(s, 0, 10);
+      break;
+    }
+
+    s = strchr(s, ' ');
+    if (s == NULL)
+      break;
+    s++;
+  }
+
+  return i > 24;
+}
+
+#define TOP_KEY(p, mem) ((mem) ? (p)->mem : (p)->cpu)
+
+/* keeps MAX_TOP biggest in h, smallest of them at h[0] */
+static void top_heap_add(struct proc_entry **h, unsigned int *len,
+    struct proc_entry *p, int mem) {
+  float v = TOP_KEY(p, mem);
+  unsigned int i, c;
+
+  if (*len < MAX_TOP) {
+    for (i = (*len)++; i > 0 && TOP_KEY(h[(i-1)/2], mem) > v; i = (i-1)/2)
+      h[i] = h[(i-1)/2];
+    h[i] = p;
+    return;
+  }
+
+  if (v <= TOP_KEY(h[0], mem))
+    return;
+
+  /* replaces smallest */
+  for (i = 0; (c = 2*i + 1) < MAX_TOP; i = c) {
+    if (c + 1 < MAX_TOP && TOP_KEY(h[c+1], mem) < TOP_KEY(h[c], mem))
+      c++;
+    if (TOP_KEY(h[c], mem) >= v)
+      break;
+    h[i] = h[c];
+  }
+  h[i] = p;
+}
+
+static void set_top(struct top_proc *top, struct proc_entry **h,
+    unsigned int len, int mem) {
+  unsigned int i, j;
+
+  /* at most MAX_TOP, biggest first */
+  for (i=0; i<len; i++) {
+    for (j=i+1; j<len; j++) {
+      if (TOP_KEY(h[j], mem) > TOP_KEY(h[i], mem)) {
+        struct proc_entry *t = h[i];
+        h[i] = h[j];
+        h[j] = t;
+      }
+    }
+
+    top[i].pid = h[i]->pid;
+    strcpy(top[i].name, h[i]->name);
+    top[i].cpu = h[i]->cpu;
+    top[i].mem = h[i]->mem;
+  }
+
+  for (; i<MAX_TOP; i++)
+    memset(&top[i], 0, sizeof(struct top_proc));
+}
+
+void update_top() {
+  static double page_percent;
+  struct proc_entry *cpu_heap[MAX_TOP], *mem_heap[MAX_TOP];
+  unsigned int cpu_len = 0, mem_len = 0;
+  char buf[1024];
+  double delta;
+  int n, i;
+
+  if (!open_proc_dir())
+    return;
+
+  if (clock_ticks == 0)
+    clock_ticks = sysconf(_SC_CLK_TCK);
+  if (page_percent == 0)
+    page_percent = 100.0 / sysconf(_SC_PHYS_PAGES);
+
+  delta = current_update_time - last_top_update;
+  last_top_update = current_update_time;
+
+  proc_generation++;
+  lseek(proc_dir_fd, 0, SEEK_SET);
+
+  while ((n = syscall(SYS_getdents64, proc_dir_fd, proc_dents, 65536)) > 0) {
+    for (i=0; i<n; ) {
+      struct linux_dirent64 *d = (struct linux_dirent64 *) (proc_dents + i);
+      struct proc_stat st;
+      struct proc_entry *p;
+      int pid;
+
+      i += d->d_reclen;
+
+      if (!isdigit(d->d_name[0]))
+        continue;
+      pid = atoi(d->d_name);
+
+      for (p = proc_hash[pid % PROC_HASH]; p; p = p->next) {
+        if (p->pid == pid)
+          break;
+      }
+
+      if (p == NULL) {
+        p = (struct proc_entry *) calloc(1, sizeof(struct proc_entry));
+        p->pid = pid;
+        p->fd = -1;
+        p->next = proc_hash[pid % PROC_HASH];
+        proc_hash[pid % PROC_HASH] = p;
+      }
+
+      if (!read_proc_stat(p, buf, 1024) || !parse_proc_stat(buf, &st))
+        continue;
+
+      if (st.starttime != p->starttime || delta <= 0.001) {
+        /* new process or pid was reused */
+        p->starttime = st.starttime;
+        p->cpu = 0;
+      }
+      else
+        p->cpu = (st.ticks - p->ticks) * 100.0 / clock_ticks / delta;
+      p->ticks = st.ticks;
+      p->mem = st.rss * page_percent;
+      strcpy(p->name, st.name);
+      p->seen = proc_generation;
+
+      top_heap_add(cpu_heap, &cpu_len, p, 0);
+      top_heap_add(mem_heap, &mem_len, p, 1);
+    }
+  }
+
+  /* remove processes that have exited */
+  for (i=0; i<PROC_HASH; i++) {
+    struct proc_entry **pp = &proc_hash[i];
+
+    while (*pp) {
+      struct proc_entry *p = *pp;
+
+      if (p->seen != proc_generation) {
+        *pp = p->next;
+        free_proc_entry(p);
+      }
+      else
+        pp = &p->next;
+    }
+  }
+
+  set_top(info.top_cpu, cpu_heap, cpu_len, 0);
+  set_top(info.top_mem, mem_heap, mem_len, 1);
+
+  info.mask |= (1 << INFO_TOP);
+}
+
+/* process counts by name
+ *
+ * With process_events, kernel's process connector tells about every fork,
+ * exec, comm change and exit, and /proc is walked only at start and when
+ * events have been lost. Otherwise (or if connector can't be used, it needs
+ * root) /proc is walked on every update. */
+
+int process_events;
+
+struct proc_name {
+  int pid;
+  char name[16];
+  struct proc_name *next;
+};
+
+static struct proc_name *proc_names[PROC_HASH];
+static struct pcount *pcounts;
+static int proc_cn_fd = -1;
+static int proc_cn_failed;
+
+static void pcount_add(const char *name, int n) {
+  struct pcount *c;
+
+  for (c = pcounts; c; c = c->next) {
+    if (strcmp(c->name, name) == 0)
+      c->count += n;
+  }
+}
+
+static int pcount_watched(const char *name) {
+  struct pcount *c;
+
+  for (c = pcounts; c; c = c->next) {
+    if (strcmp(c->name, name) == 0)
+      return 1;
+  }
+
+  return 0;
+}
+
+/* returns 1 if some watched count changed */
+static int set_proc_name(int pid, const char *name) {
+  struct proc_name *p;
+  int r;
+
+  for (p = proc_names[pid % PROC_HASH]; p; p = p->next) {
+    if (p->pid == pid)
+      break;
+  }
+
+  if (p == NULL) {
+    p = (struct proc_name *) calloc(1, sizeof(struct proc_name));
+    p->pid = pid;
+    p->next = proc_names[pid % PROC_HASH];
+    proc_names[pid % PROC_HASH] = p;
+  }
+  else if (strcmp(p->name, name) == 0)
+    return 0;
+
+  r = pcount_watched(p->name) || pcount_watched(name);
+  pcount_add(p->name, -1);
+  snprintf(p->name, 16, "%s", name);
+  pcount_add(p->name, 1);
+
+  return r;
+}
+
+static int remove_proc_name(int pid) {
+  struct proc_name **pp;
+
+  for (pp = &proc_names[pid % PROC_HASH]; *pp; pp = &(*pp)->next) {
+    struct proc_name *p = *pp;
+
+    if (p->pid == pid) {
+      int r = pcount_watched(p->name);
+
+      pcount_add(p->name, -1);
+      *pp = p->next;
+      free(p);
+      return r;
+    }
+  }
+
+  return 0;
+}
+
+static const char *get_proc_name(int pid) {
+  struct proc_name *p;
+
+  for (p = proc_names[pid % PROC_HASH]; p; p = p->next) {
+    if (p->pid == pid)
+      return p->name;
+  }
+
+  return 0;
+}
+
+/* reads comm of process, returns 0 if it's gone */
+static int read_proc_comm(int pid, char *name) {
+  char path[32];
+  int fd, n;
+
+  snprintf(path, 32, "%d/comm", pid);
+  fd = openat(proc_dir_fd, path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return 0;
+
+  n = read(fd, name, 15);
+  close(fd);
+  if (n <= 0)
+    return 0;
+
+  name[n] = '\0';
+  if (name[n-1] == '\n')
+    name[n-1] = '\0';
+
+  return 1;
+}
+
+static void clear_proc_names() {
+  struct pcount *c;
+  unsigned int i;
+
+  for (i=0; i<PROC_HASH; i++) {
+    while (proc_names[i]) {
+      struct proc_name *p = proc_names[i];
+      proc_names[i] = p->next;
+      free(p);
+    }
+  }
+
+  for (c = pcounts; c; c = c->next)
+    c->count = 0;
+}
+
+static void walk_proc_names() {
+  int n, i;
+
+  clear_proc_names();
+
+  if (!open_proc_dir())
+    return;
+
+  lseek(proc_dir_fd, 0, SEEK_SET);
+
+  while ((n = syscall(SYS_getdents64, proc_dir_fd, proc_dents, 65536)) > 0) {
+    for (i=0; i<n; ) {
+      struct linux_dirent64 *d = (struct linux_dirent64 *) (proc_dents + i);
+      char name[16];
+
+      i += d->d_reclen;
+
+      if (isdigit(d->d_name[0]) && read_proc_comm(atoi(d->d_name), name))
+        set_proc_name(atoi(d->d_name), name);
+    }
+  }
+}
+
+static int proc_cn_handler(int fd) {
+  char buf[8192];
+  int r = 0;
+
+  for (;;) {
+    struct nlmsghdr *h;
+    int n = recv(fd, buf, sizeof(buf), 0);
+
+    if (n < 0) {
+      /* kernel dropped events, everything is read again */
+      if (errno == ENOBUFS) {
+        walk_proc_names();
+        r = 1;
+        continue;
+      }
+      break;
+    }
+
+    for (h = (struct nlmsghdr *) buf; NLMSG_OK(h, (unsigned int) n);
+        h = NLMSG_NEXT(h, n)) {
+      struct cn_msg *msg = (struct cn_msg *) NLMSG_DATA(h);
+      struct proc_event *ev = (struct proc_event *) msg->data;
+      char name[16];
+      const char *parent;
+
+      if (h->nlmsg_type != NLMSG_DONE)
+        continue;
+
+      switch (ev->what) {
+      case PROC_EVENT_FORK:
+        /* threads aren't processes */
+        if (ev->event_data.fork.child_pid != ev->event_data.fork.child_tgid)
+          break;
+        parent = get_proc_name(ev->event_data.fork.parent_tgid);
+        if (parent)
+          r |= set_proc_name(ev->event_data.fork.child_pid, parent);
+        else if (read_proc_comm(ev->event_data.fork.child_pid, name))
+          r |= set_proc_name(ev->event_data.fork.child_pid, name);
+        break;
+
+      case PROC_EVENT_EXEC:
+        if (read_proc_comm(ev->event_data.exec.process_tgid, name))
+          r |= set_proc_name(ev->event_data.exec.process_tgid, name);
+        break;
+
+      case PROC_EVENT_COMM:
+        if (ev->event_data.comm.process_pid !=
+            ev->event_data.comm.process_tgid)
+          break;
+        snprintf(name, 16, "%s", ev->event_data.comm.comm);
+        r |= set_proc_name(ev->event_data.comm.process_pid, name);
+        break;
+
+      case PROC_EVENT_EXIT:
+        if (ev->event_data.exit.process_pid ==
+            ev->event_data.exit.process_tgid)
+          r |= remove_proc_name(ev->event_data.exit.process_pid);
+        break;
+
+      default:
+        break;
+      }
+    }
+  }
+
+  return r;
+}
+
+static int start_proc_cn() {
+  struct sockaddr_nl addr;
+  struct {
+    struct nlmsghdr h;
+    struct cn_msg msg;
+    enum proc_cn_mcast_op op;
+  } __attribute__((packed)) req;
+  int size = 1024*1024;
+
+  proc_cn_fd = socket(PF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+      NETLINK_CONNECTOR);
+  if (proc_cn_fd < 0)
+    goto fail;
+
+  /* big buffer for fork storms, needs root to go over rmem_max */
+  if (setsockopt(proc_cn_fd, SOL_SOCKET, SO_RCVBUFFORCE, &size,
+        sizeof(size)) != 0)
+    setsockopt(proc_cn_fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+  memset(&addr, 0, sizeof(addr));
+  addr.nl_family = AF_NETLINK;
+  addr.nl_groups = CN_IDX_PROC;
+  if (bind(proc_cn_fd, (struct sockaddr *) &addr, sizeof(addr)) != 0)
+    goto fail;
+
+  memset(&req, 0, sizeof(req));
+  req.h.nlmsg_len = sizeof(req);
+  req.h.nlmsg_type = NLMSG_DONE;
+  req.msg.id.idx = CN_IDX_PROC;
+  req.msg.id.val = CN_VAL_PROC;
+  req.msg.len = sizeof(enum proc_cn_mcast_op);
+  req.op = PROC_CN_MCAST_LISTEN;
+  if (send(proc_cn_fd, &req, sizeof(req), 0) != sizeof(req))
+    goto fail;
+
+  add_update_fd(proc_cn_fd, proc_cn_handler);
+  return 1;
+
+fail:
+  ERR("can't use process connector, walking /proc instead: %s",
+      strerror(errno));
+  if (proc_cn_fd >= 0)
+    close(proc_cn_fd);
+  proc_cn_fd = -1;
+  proc_cn_failed = 1;
+  return 0;
+}
+
+/* returns counter for processes named name, same name is shared */
+struct pcount *get_pcount(const char *name) {
+  struct pcount *c;
+  char comm[16];
+
+  /* comm is at most 15 characters */
+  snprintf(comm, 16, "%s", name);
+
+  for (c = pcounts; c; c = c->next) {
+    if (strcmp(c->name, comm) == 0)
+      return c;
+  }
+
+  c = (struct pcount *) calloc(1, sizeof(struct pcount));
+  strcpy(c->name, comm);
+  c->next = pcounts;
+  pcounts = c;
+
+  /* counted again from scratch */
+  if (proc_cn_fd >= 0)
+    walk_proc_names();
+
+  return c;
+}
+
+void clear_pcounts() {
+  if (proc_cn_fd >= 0) {
+    remove_update_fd(proc_cn_fd);
+    close(proc_cn_fd);
+    proc_cn_fd = -1;
+  }
+  proc_cn_failed = 0;
+
+  clear_proc_names();
+
+  while (pcounts) {
+    struct pcount *c = pcounts;
+    pcounts = c->next;
+    free(c);
+  }
+}
+
+void update_pcounts() {
+  if (proc_cn_fd >= 0)
+    return;
+
+  /* events are listened before walking so nothing is missed */
+  if (process_events && !proc_cn_failed)
+    start_proc_cn();
+
+  walk_proc_names();
+}
+
+/* watched processes
+ *
+ * Process is found from pidfile (spec starts with /) or by name once, and
+ * its stat, io and fd directory are kept open and read again with pread()
+ * until process dies. Then it is looked for again, at most every 5 seconds
+ * if it can't be found. */
+
+static struct watched_proc *watched_procs;
+
+static void close_watched_proc(struct watched_proc *w) {
+  if (w->stat_fd >= 0) close(w->stat_fd);
+  if (w->io_fd >= 0) close(w->io_fd);
+  if (w->fd_dir >= 0) close(w->fd_dir);
+  w->stat_fd = w->io_fd = w->fd_dir = -1;
+
+  w->pid = 0;
+  w->cpu = 0;
+  w->rss = 0;
+  w->threads = 0;
+  w->fds = 0;
+  w->io_read = 0;
+  w->read_bytes = 0;
+}
+
+static int read_pidfile(const char *path) {
+  char buf[32];
+  int fd, n;
+
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return 0;
+  n = read(fd, buf, 31);
+  close(fd);
+  if (n <= 0)
+    return 0;
+  buf[n] = '\0';
+
+  return atoi(buf);
+}
+
+/* comm is cut to 15 characters, so longer names are compared against the
+ * file name of argv[0] */
+static int proc_name_matches(const char *pid, const char *comm,
+    const char *name) {
+  char buf[1024], path[32], *p;
+  int fd, len;
+
+  if (strlen(name) < 16)
+    return strcmp(comm, name) == 0;
+
+  if (strncmp(comm, name, 15) != 0)
+    return 0;
+
+  snprintf(path, 32, "%s/cmdline", pid);
+  fd = openat(proc_dir_fd, path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return 0;
+  len = read(fd, buf, 1023);
+  close(fd);
+  if (len <= 0)
+    return 0;
+  buf[len] = '\0';
+
+  p = strrchr(buf, '/');
+  return strcmp(p ? p+1 : buf, name) == 0;
+}
+
+/* oldest process with name, it's usually the master of daemon */
+static int find_proc_by_name(const char *name) {
+  unsigned long long oldest = 0;
+  int n, i, pid = 0;
+
+  if (!open_proc_dir())
+    return 0;
+
+  lseek(proc_dir_fd, 0, SEEK_SET);
+
+  while ((n = syscall(SYS_getdents64, proc_dir_fd, proc_dents, 65536)) > 0) {
+    for (i=0; i<n; ) {
+      struct linux_dirent64 *d = (struct linux_dirent64 *) (proc_dents + i);
+      char comm[16], buf[1024], path[32];
+      struct proc_stat st;
+      int fd, len;
+
+      i += d->d_reclen;
+
+      if (!isdigit(d->d_name[0]) || !read_proc_comm(atoi(d->d_name), comm) ||
+          !proc_name_matches(d->d_name, comm, name))
+        continue;
+
+      snprintf(path, 32, "%s/stat", d->d_name);
+      fd = openat(proc_dir_fd, path, O_RDONLY | O_CLOEXEC);
+      if (fd < 0)
+        continue;
+      len = read(fd, buf, 1023);
+      close(fd);
+      if (len <= 0)
+        continue;
+      buf[len] = '\0';
+
+      if (parse_proc_stat(buf, &st) && (pid == 0 || st.starttime < oldest)) {
+        pid = atoi(d->d_name);
+        oldest = st.starttime;
+      }
+    }
+  }
+
+  return pid;
+}
+
+static int open_watched_proc(struct watched_proc *w) {
+  char path[64];
+  int pid;
+
+  if (w->spec[0] == '/')
+    pid = read_pidfile(w->spec);
+  else
+    pid = find_proc_by_name(w->spec);
+  if (pid <= 0 || !open_proc_dir())
+    return 0;
+
+  snprintf(path, 64, "%d/stat", pid);
+  w->stat_fd = openat(proc_dir_fd, path, O_RDONLY | O_CLOEXEC);
+  if (w->stat_fd < 0)
+    return 0;
+
+  /* io needs same user or root */
+  if (w->want & WATCH_IO) {
+    snprintf(path, 64, "%d/io", pid);
+    w->io_fd = openat(proc_dir_fd, path, O_RDONLY | O_CLOEXEC);
+  }
+  if (w->want & WATCH_FDS) {
+    snprintf(path, 64, "%d/fd", pid);
+    w->fd_dir = openat(proc_dir_fd, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  }
+
+  w->pid = pid;
+  w->starttime = 0;
+  return 1;
+}
+
+static int count_fds(int dir) {
+  int n, i, count = 0;
+
+  lseek(dir, 0, SEEK_SET);
+  while ((n = syscall(SYS_getdents64, dir, proc_dents, 65536)) > 0) {
+    for (i=0; i<n; ) {
+      struct linux_dirent64 *d = (struct linux_dirent64 *) (proc_dents + i);
+
+      if (d->d_name[0] != '.')
+        count++;
+      i += d->d_reclen;
+    }
+  }
+
+  return count;
+}
+
+static void update_watched_proc(struct watched_proc *w) {
+  struct proc_stat st;
+  char buf[1024];
+  double delta;
+  int n;
+
+  if (w->pid == 0) {
+    if (current_update_time - w->last_try < 5.0)
+      return;
+    w->last_try = current_update_time;
+
+    if (!open_watched_proc(w)) {
+      close_watched_proc(w);
+      return;
+    }
+  }
+
+  /* fails after process has died */
+  n = pread(w->stat_fd, buf, 1023, 0);
+  if (n <= 0) {
+    close_watched_proc(w);
+    w->last_try = 0;
+    return;
+  }
+  buf[n] = '\0';
+  if (!parse_proc_stat(buf, &st))
+    return;
+
+  if (clock_ticks == 0)
+    clock_ticks = sysconf(_SC_CLK_TCK);
+
+  delta = current_update_time - w->last_update;
+  w->last_update = current_update_time;
+
+  if (w->starttime == 0 || delta <= 0.001)
+    w->cpu = 0;
+  else
+    w->cpu = (st.ticks - w->ticks) * 100.0 / clock_ticks / delta;
+  w->ticks = st.ticks;
+  w->starttime = st.starttime;
+  w->rss = (long long) st.rss * sysconf(_SC_PAGESIZE);
+  w->threads = st.threads;
+
+  if (w->io_fd >= 0) {
+    n = pread(w->io_fd, buf, 1023, 0);
+    if (n > 0) {
+      char *p;
+      unsigned long long r;
+
+      buf[n] = '\0';
+      p = strstr(buf, "read_bytes: ");
+      if (p) {
+        r = strtoull(p + 12, 0, 10);
+        w->io_read = (w->read_bytes && delta > 0.001) ?
+          (r - w->read_bytes) / delta : 0;
+        w->read_bytes = r;
+      }
+    }
+  }
+
+  if (w->fd_dir >= 0)
+    w->fds = count_fds(w->fd_dir);
+}
+
+/* returns watched process for pidfile or name, same spec is shared */
+struct watched_proc *get_watched_proc(const char *spec, int want) {
+  struct watched_proc *w;
+
+  for (w = watched_procs; w; w = w->next) {
+    if (strcmp(w->spec, spec) == 0)
+      break;
+  }
+
+  if (w == NULL) {
+    w = (struct watched_proc *) calloc(1, sizeof(struct watched_proc));
+    w->spec = strdup(spec);
+    w->stat_fd = w->io_fd = w->fd_dir = -1;
+    w->next = watched_procs;
+    watched_procs = w;
+  }
+
+  /* fds are opened again with new needs */
+  if ((w->want | want) != w->want) {
+    w->want |= want;
+    close_watched_proc(w);
+    w->last_try = 0;
+  }
+
+  return w;
+}
+
+void clear_watched_procs() {
+  while (watched_procs) {
+    struct watched_proc *w = watched_procs;
+    watched_procs = w->next;
+
+    close_watched_proc(w);
+    free(w->spec);
+    free(w);
+  }
+}
+
+void update_watched_procs() {
+  struct watched_proc *w;
+
+  for (w = watched_procs; w; w = w->next)
+    update_watched_proc(w);
+}
+
+/* cgroup v2
+ *
+ * Files of a cgroup are opened once and read again with pread(). If the
+ * cgroup is removed reads fail and it's opened again later. */
+
+char *cgroup_root;
+
+static struct cgroup_stat *cgroup_stats;
+static struct cgroup_top *cgroup_tops;
+
+/* io.stat has a line per device, there can be lots of them */
+static char *cgroup_io_buf;
+static unsigned int cgroup_io_buf_size;
+
+static const char *cgroup_files[CGROUP_FILES] = {
+  "cpu.stat", "memory.current", "memory.max", "io.stat", "pids.current",
+};
+
+static void close_cgroup(struct cgroup_stat *c) {
+  unsigned int i;
+
+  for (i=0; i<CGROUP_FILES; i++) {
+    if (c->fd[i] >= 0)
+      close(c->fd[i]);
+    c->fd[i] = -1;
+  }
+
+  c->open = 0;
+  c->usage_usec = 0;
+  c->cpu = 0;
+  c->mem = 0;
+  c->io_read = c->io_write = 0;
+  c->read_bytes = c->write_bytes = 0;
+  c->pids = 0;
+}
+
+/* opens wanted files, dir is relative to dir_fd if it isn't -1 */
+static int open_cgroup(struct cgroup_stat *c, int dir_fd, const char *dir) {
+  char path[512];
+  unsigned int i;
+
+  for (i=0; i<CGROUP_FILES; i++) {
+    if (!(c->want & (1 << i)))
+      continue;
+
+    snprintf(path, 512, "%s/%s", dir, cgroup_files[i]);
+    c->fd[i] = openat(dir_fd < 0 ? AT_FDCWD : dir_fd, path,
+        O_RDONLY | O_CLOEXEC);
+  }
+
+  /* every cgroup has cpu.stat, controllers may be missing */
+  if (c->fd[CGROUP_CPU] < 0) {
+    close_cgroup(c);
+    return 0;
+  }
+
+  c->open = 1;
+  return 1;
+}
+
+/* reads io.stat, device is "major:minor" or all are summed */
+static void read_cgroup_io(struct cgroup_stat *c, unsigned long long *r,
+    unsigned long long *w) {
+  char *l;
+
+  *r = *w = 0;
+  if (pread_all(c->fd[CGROUP_IO], &cgroup_io_buf, &cgroup_io_buf_size) <= 0)
+    return;
+
+  for (l = cgroup_io_buf; l && *l; l = strchr(l, '\n') ? strchr(l, '\n') + 1 : 0) {
+    char *p;
+
+    if (c->dev && (strncmp(l, c->dev, strlen(c->dev)) != 0 ||
+          l[strlen(c->dev)] != ' '))
+      continue;
+
+    p = strstr(l, "rbytes=");
+    if (p) *r += strtoull(p + 7, 0, 10);
+    p = strstr(l, "wbytes=");
+    if (p) *w += strtoull(p + 7, 0, 10);
+  }
+}
+
+static void read_cgroup(struct cgroup_stat *c) {
+  char buf[256];
+  double delta;
+  unsigned long long usage;
+
+  /* fails when cgroup has been removed */
+  if (pread_file(c->fd[CGROUP_CPU], buf, 256) <= 0 ||
+      sscanf(buf, "usage_usec %Lu", &usage) != 1) {
+    close_cgroup(c);
+    return;
+  }
+
+  delta = current_update_time - c->last_update;
+  c->last_update = current_update_time;
+
+  c->cpu = (c->usage_usec && delta > 0.001) ?
+    (usage - c->usage_usec) / 10000.0 / delta : 0;
+  c->usage_usec = usage;
+
+  if (pread_file(c->fd[CGROUP_MEM], buf, 256) > 0)
+    c->mem = strtoll(buf, 0, 10);
+
+  if (pread_file(c->fd[CGROUP_MEM_MAX], buf, 256) > 0)
+    c->mem_max = strncmp(buf, "max", 3) == 0 ? -1 : strtoll(buf, 0, 10);
+
+  if (pread_file(c->fd[CGROUP_PIDS], buf, 256) > 0)
+    c->pids = strtoul(buf, 0, 10);
+
+  if (c->fd[CGROUP_IO] >= 0) {
+    unsigned long long r, w;
+
+    read_cgroup_io(c, &r, &w);
+    if (c->read_bytes && delta > 0.001) {
+      c->io_read = (r - c->read_bytes) / delta;
+      c->io_write = (w - c->write_bytes) / delta;
+    }
+    c->read_bytes = r;
+    c->write_bytes = w;
+  }
+}
+
+static void cgroup_path(char *buf, unsigned int n, const char *path) {
+  /* relative to cgroup_root */
+  if (path[0] == '/')
+    snprintf(buf, n, "%s", path);
+  else
+    snprintf(buf, n, "%s/%s", cgroup_root ? cgroup_root : "/sys/fs/cgroup",
+        path);
+}
+
+/* returns cgroup stat for path and io device, same ones are shared */
+struct cgroup_stat *get_cgroup_stat(const char *path, const char *dev,
+    int want) {
+  struct cgroup_stat *c;
+  char buf[512];
+
+  cgroup_path(buf, 512, path);
+
+  for (c = cgroup_stats; c; c = c->next) {
+    if (strcmp(c->path, buf) == 0 &&
+        ((dev == NULL && c->dev == NULL) ||
+         (dev && c->dev && strcmp(dev, c->dev) == 0)))
+      break;
+  }
+
+  if (c == NULL) {
+    unsigned int i;
+
+    c = (struct cgroup_stat *) calloc(1, sizeof(struct cgroup_stat));
+    c->path = strdup(buf);
+    c->dev = dev ? strdup(dev) : 0;
+    for (i=0; i<CGROUP_FILES; i++)
+      c->fd[i] = -1;
+    c->next = cgroup_stats;
+    cgroup_stats = c;
+  }
+
+  /* every wanted file must be opened */
+  want |= 1 << CGROUP_CPU;
+  if ((c->want | want) != c->want) {
+    c->want |= want;
+    close_cgroup(c);
+    c->last_try = 0;
+  }
+
+  return c;
+}
+
+/* child cgroups of parent ordered by cpu and memory usage */
+struct cgroup_top *get_cgroup_top(const char *parent) {
+  struct cgroup_top *t;
+  char buf[512];
+
+  cgroup_path(buf, 512, parent ? parent : "");
+
+  for (t = cgroup_tops; t; t = t->next) {
+    if (strcmp(t->path, buf) == 0)
+      return t;
+  }
+
+  t = (struct cgroup_top *) calloc(1, sizeof(struct cgroup_top));
+  t->path = strdup(buf);
+  t->dir_fd = -1;
+  t->next = cgroup_tops;
+  cgroup_tops = t;
+
+  return t;
+}
+
+static void free_cgroup(struct cgroup_stat *c) {
+  close_cgroup(c);
+  free(c->path);
+  free(c->dev);
+  free(c);
+}
+
+/* insertion into MAX_TOP biggest by cpu or mem, returns new row count */
+static int insert_cgroup_top(struct cgroup_top_entry *top, int rows,
+    struct cgroup_stat *c, int by_mem) {
+  int i;
+
+  for (i = rows; i > 0 && (by_mem ? top[i-1].mem < c->mem :
+        top[i-1].cpu < c->cpu); i--) {
+    if (i < MAX_TOP)
+      top[i] = top[i-1];
+  }
+  if (i < MAX_TOP) {
+    snprintf(top[i].name, 64, "%s", c->path);
+    top[i].cpu = c->cpu;
+    top[i].mem = c->mem;
+    if (rows < MAX_TOP)
+      rows++;
+  }
+
+  return rows;
+}
+
+static void update_cgroup_top(struct cgroup_top *t) {
+  struct cgroup_stat *c, **cp;
+  int n, i, rows = 0;
+
+  if (t->dir_fd < 0) {
+    t->dir_fd = open(t->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (t->dir_fd < 0) {
+      if (!t->rep) {
+        ERR("can't open %s: %s", t->path, strerror(errno));
+        t->rep = 1;
+      }
+      return;
+    }
+    if (proc_dents == NULL)
+      proc_dents = (char *) malloc(65536);
+  }
+
+  t->generation++;
+  lseek(t->dir_fd, 0, SEEK_SET);
+
+  while ((n = syscall(SYS_getdents64, t->dir_fd, proc_dents, 65536)) > 0) {
+    for (i=0; i<n; ) {
+      struct linux_dirent64 *d = (struct linux_dirent64 *) (proc_dents + i);
+
+      i += d->d_reclen;
+      if (d->d_type != DT_DIR || d->d_name[0] == '.')
+        continue;
+
+      for (c = t->children; c; c = c->next) {
+        if (strcmp(c->path, d->d_name) == 0)
+          break;
+      }
+
+      if (c == NULL) {
+        unsigned int j;
+
+        c = (struct cgroup_stat *) calloc(1, sizeof(struct cgroup_stat));
+        c->path = strdup(d->d_name);
+        c->want = (1 << CGROUP_CPU) | (1 << CGROUP_MEM);
+        for (j=0; j<CGROUP_FILES; j++)
+          c->fd[j] = -1;
+        c->next = t->children;
+        t->children = c;
+      }
+
+      c->seen = t->generation;
+    }
+  }
+
+  /* removed cgroups are forgotten, others read and ranked */
+  memset(t->top_cpu, 0, sizeof(t->top_cpu));
+  memset(t->top_mem, 0, sizeof(t->top_mem));
+
+  for (cp = &t->children; *cp; ) {
+    c = *cp;
+
+    if (c->seen != t->generation ||
+        (!c->open && !open_cgroup(c, t->dir_fd, c->path))) {
+      *cp = c->next;
+      free_cgroup(c);
+      continue;
+    }
+    cp = &c->next;
+
+    read_cgroup(c);
+    if (!c->open)
+      continue;
+
+    insert_cgroup_top(t->top_mem, rows, c, 1);
+    rows = insert_cgroup_top(t->top_cpu, rows, c, 0);
+  }
+}
+
+void clear_cgroups() {
+  while (cgroup_stats) {
+    struct cgroup_stat *c = cgroup_stats;
+    cgroup_stats = c->next;
+    free_cgroup(c);
+  }
+
+  while (cgroup_tops) {
+    struct cgroup_top *t = cgroup_tops;
+    cgroup_tops = t->next;
+
+    while (t->children) {
+      struct cgroup_stat *c = t->children;
+      t->children = c->next;
+      free_cgroup(c);
+    }
+    if (t->dir_fd >= 0)
+      close(t->dir_fd);
+    free(t->path);
+    free(t);
+  }
+}
+
+void update_cgroups() {
+  struct cgroup_stat *c;
+  struct cgroup_top *t;
+
+  for (c = cgroup_stats; c; c = c->next) {
+    if (!c->open) {
+      /* cgroup may come back */
+      if (current_update_time - c->last_try < 5.0)
+        continue;
+      c->last_try = current_update_time;
+      if (!open_cgroup(c, -1, c->path))
+        continue;
+    }
+
+    read_cgroup(c);
+  }
+
+  for (t = cgroup_tops; t; t = t->next)
+    update_cgroup_top(t);
+}
+
+/* pressure stall information
+ *
+ * Files in /proc/pressure are kept open and read with pread(). With
+ * psi_trigger kernel wakes main_loop() up with POLLPRI when stall time in
+ * window goes over threshold, so text is updated right away. */
+
+static const char *psi_names[PSI_RESOURCES] = { "cpu", "memory", "io", "irq" };
+
+static struct {
+  int wanted;
+  int open, fd;
+  int rep;
+  struct psi_stat some, full;
+} psi[PSI_RESOURCES];
+
+static int psi_triggers[PSI_RESOURCES * 4];
+static unsigned int psi_trigger_count;
+
+static int psi_resource(const char *name) {
+  int i;
+
+  for (i=0; i<PSI_RESOURCES; i++) {
+    if (strcmp(psi_names[i], name) == 0)
+      return i;
+  }
+
+  return -1;
+}
+
+/* returns some or full line of resource, resource is read on updates */
+struct psi_stat *get_psi(const char *resource, int full) {
+  int i = psi_resource(resource);
+
+  if (i < 0)
+    return 0;
+
+  psi[i].wanted = 1;
+  return full ? &psi[i].full : &psi[i].some;
+}
+
+static int psi_trigger_handler(int fd) {
+  (void) fd;
+  /* stall went over threshold, read everything again */
+  return 1;
+}
+
+/* "memory some 150000 1000000", stall and window in microseconds */
+void add_psi_trigger(const char *arg) {
+  char name[16], kind[8], buf[64];
+  unsigned int stall, window;
+  int i, fd;
+
+  if (sscanf(arg, "%15s %7s %u %u", name, kind, &stall, &window) != 4 ||
+      (i = psi_resource(name)) < 0 ||
+      (strcmp(kind, "some") != 0 && strcmp(kind, "full") != 0)) {
+    ERR("psi_trigger: resource some|full stall_us window_us");
+    return;
+  }
+
+  if (psi_trigger_count >= PSI_RESOURCES * 4) {
+    ERR("too many psi triggers");
+    return;
+  }
+
+  snprintf(buf, 64, "/proc/pressure/%s", name);
+  fd = open(buf, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+  if (fd < 0) {
+    ERR("can't open %s: %s", buf, strerror(errno));
+    return;
+  }
+
+  /* trigger lives as long as fd is open */
+  snprintf(buf, 64, "%s %u %u", kind, stall, window);
+  if (write(fd, buf, strlen(buf) + 1) < 0) {
+    ERR("can't set psi trigger '%s' for %s: %s", buf, name,
+        strerror(errno));
+    close(fd);
+    return;
+  }
+
+  psi_triggers[psi_trigger_count++] = fd;
+  add_update_pri_fd(fd, psi_trigger_handler);
+  psi[i].wanted = 1;
+}
+
+void clear_psi() {
+  unsigned int i;
+
+  for (i=0; i<psi_trigger_count; i++) {
+    remove_update_fd(psi_triggers[i]);
+    close(psi_triggers[i]);
+  }
+  psi_trigger_count = 0;
+
+  for (i=0; i<PSI_RESOURCES; i++)
+    psi[i].wanted = 0;
+}
+
+static void parse_psi_line(const char *l, struct psi_stat *p) {
+  sscanf(l, "%*s avg10=%f avg60=%f avg300=%f total=%Lu", &p->avg10,
+      &p->avg60, &p->avg300, &p->total);
+}
+
+void update_psi() {
+  char buf[256];
+  int i;
+
+  for (i=0; i<PSI_RESOURCES; i++) {
+    char *full;
+
+    if (!psi[i].wanted)
+      continue;
+
+    if (!psi[i].open) {
+      snprintf(buf, 256, "/proc/pressure/%s", psi_names[i]);
+      psi[i].fd = open(buf, O_RDONLY | O_CLOEXEC);
+      if (psi[i].fd < 0) {
+        if (!psi[i].rep) {
+          ERR("can't open %s: %s", buf, strerror(errno));
+          psi[i].rep = 1;
+        }
+        continue;
+      }
+      psi[i].open = 1;
+    }
+
+    if (pread_file(psi[i].fd, buf, 256) <= 0)
+      continue;
+
+    /* cpu has full line only since Linux 5.13, irq has only full */
+    if (strncmp(buf, "some ", 5) == 0)
+      parse_psi_line(buf, &psi[i].some);
+    full = strstr(buf, "full ");
+    if (full)
+      parse_psi_line(full, &psi[i].full);
+  }
+
+  info.mask |= (1 << INFO_PSI);
+}
+
+/* /proc/vmstat
+ *
+ * Only counters that are used are kept, each remembers on which line it
+ * was so a pass just jumps from line to line. If kernel prints something
+ * else on that line (new kernel, hotplugged zone) lines are looked up
+ * again. */
+
+static struct vmstat_counter vmstat_counters[MAX_VMSTAT];
+static unsigned int vmstat_count;
+static int vmstat_fd = -1;
+static int vmstat_lines_ok;
+static double last_vmstat_update;
+
+struct vmstat_counter *get_vmstat(const char *name) {
+  unsigned int i;
+
+  for (i=0; i<vmstat_count; i++) {
+    if (strcmp(vmstat_counters[i].name, name) == 0)
+      return &vmstat_counters[i];
+  }
+
+  if (vmstat_count >= MAX_VMSTAT) {
+    ERR("too many vmstat counters (limit is %d)", MAX_VMSTAT);
+    return 0;
+  }
+
+  memset(&vmstat_counters[i], 0, sizeof(struct vmstat_counter));
+  snprintf(vmstat_counters[i].name, 32, "%s", name);
+  vmstat_counters[i].line = -1;
+  vmstat_count++;
+  vmstat_lines_ok = 0;
+
+  return &vmstat_counters[i];
+}
+
+void clear_vmstat() {
+  vmstat_count = 0;
+}
+
+/* "name value" */
+static int vmstat_line_is(const char *l, const char *name) {
+  unsigned int len = strlen(name);
+  return strncmp(l, name, len) == 0 && l[len] == ' ';
+}
+
+void update_vmstat() {
+  static int rep;
+  static char buf[16384];
+  static char *lines[512];
+  unsigned int nlines = 0, i;
+  double delta;
+  char *l;
+
+  if (vmstat_fd < 0) {
+    vmstat_fd = open("/proc/vmstat", O_RDONLY | O_CLOEXEC);
+    if (vmstat_fd < 0) {
+      if (!rep) {
+        ERR("can't open /proc/vmstat: %s", strerror(errno));
+        rep = 1;
+      }
+      return;
+    }
+  }
+  if (pread_file(vmstat_fd, buf, sizeof(buf)) <= 0)
+    return;
+
+  for (l = buf; *l && nlines < 512; nlines++) {
+    lines[nlines] = l;
+    l = strchr(l, '\n');
+    if (l == NULL)
+      break;
+    l++;
+  }
+
+  /* find lines of counters again */
+  for (i=0; i<vmstat_count && vmstat_lines_ok; i++) {
+    struct vmstat_counter *v = &vmstat_counters[i];
+
+    if (v->line >= 0 && ((unsigned int) v->line >= nlines ||
+          !vmstat_line_is(lines[v->line], v->name)))
+      vmstat_lines_ok = 0;
+  }
+
+  if (!vmstat_lines_ok) {
+    for (i=0; i<vmstat_count; i++) {
+      struct vmstat_counter *v = &vmstat_counters[i];
+      unsigned int j;
+
+      /* may not exist in this kernel */
+      v->line = -1;
+      for (j=0; j<nlines; j++) {
+        if (vmstat_line_is(lines[j], v->name)) {
+          v->line = j;
+          break;
+        }
+      }
+    }
+    vmstat_lines_ok = 1;
+  }
+
+  delta = current_update_time - last_vmstat_update;
+  last_vmstat_update = current_update_time;
+
+  for (i=0; i<vmstat_count; i++) {
+    struct vmstat_counter *v = &vmstat_counters[i];
+    unsigned long long value;
+
+    if (v->line < 0)
+      continue;
+
+    value = strtoull(lines[v->line] + strlen(v->name) + 1, 0, 10);
+    v->rate = (v->valid && delta > 0.001) ? (value - v->value) / delta : 0;
+    v->value = value;
+    v->valid = 1;
+  }
+
+  info.mask |= (1 << INFO_VMSTAT);
+}
+
+/* /proc/interrupts
+ *
+ * First line has online cpus, then there's a line for each irq with a
+ * count for each cpu and name of it. Counts are kept in irq by cpu matrix
+ * so that difference to last update is one loop over it. */
+
+static int irq_fd = -1;
+static char *irq_buf;
+static unsigned int irq_buf_size;
+
+static unsigned int irq_rows, irq_cols;
+static unsigned long long *irq_counts, *irq_last;
+static unsigned long long *irq_sum, *irq_cpu_sum;
+static int *irq_col_cpu;                /* cpu number of column */
+static char (*irq_label)[16];
+static char (*irq_name)[32];
+static double last_irq_update;
+
+static void irq_top_add(unsigned int r, float rate) {
+  int i;
+
+  if (rate <= info.irq_top[MAX_IRQ_TOP-1].rate)
+    return;
+
+  for (i=MAX_IRQ_TOP-1; i>0 && info.irq_top[i-1].rate < rate; i--)
+    info.irq_top[i] = info.irq_top[i-1];
+
+  snprintf(info.irq_top[i].irq, 16, "%s", irq_label[r]);
+  snprintf(info.irq_top[i].name, 32, "%s", irq_name[r]);
+  info.irq_top[i].rate = rate;
+}
+
+void update_irqs() {
+  static int rep;
+  unsigned int rows = 0, cols = 0, r, c, i, max_cpu = 0;
+  unsigned long long *t;
+  int len, fresh = 0;
+  double delta;
+  char *l, *e;
+
+  if (irq_fd < 0) {
+    irq_fd = open("/proc/interrupts", O_RDONLY | O_CLOEXEC);
+    if (irq_fd < 0) {
+      if (!rep) {
+        ERR("can't open /proc/interrupts: %s", strerror(errno));
+        rep = 1;
+      }
+      return;
+    }
+  }
+
+  /* a line is a few kilobytes with hundreds of cpus */
+  len = pread_all(irq_fd, &irq_buf, &irq_buf_size);
+  if (len <= 0)
+    return;
+
+  /* count cpus and irqs */
+  for (l = irq_buf; *l && *l != '\n'; ) {
+    if (strncmp(l, "CPU", 3) == 0)
+      cols++;
+    while (*l && *l != '\n' && *l != ' ')
+      l++;
+    while (*l == ' ')
+      l++;
+  }
+  for (; *l; l++) {
+    if (*l == '\n' && l[1])
+      rows++;
+  }
+
+  if (rows != irq_rows || cols != irq_cols) {
+    irq_rows = rows;
+    irq_cols = cols;
+    irq_counts = (unsigned long long *) realloc(irq_counts,
+        rows * cols * sizeof(unsigned long long) + 1);
+    irq_last = (unsigned long long *) realloc(irq_last,
+        rows * cols * sizeof(unsigned long long) + 1);
+    irq_sum = (unsigned long long *) realloc(irq_sum,
+        rows * sizeof(unsigned long long) + 1);
+    irq_cpu_sum = (unsigned long long *) realloc(irq_cpu_sum,
+        cols * sizeof(unsigned long long) + 1);
+    irq_col_cpu = (int *) realloc(irq_col_cpu, cols * sizeof(int) + 1);
+    irq_label = (char (*)[16]) realloc(irq_label, rows * 16 + 1);
+    irq_name = (char (*)[32]) realloc(irq_name, rows * 32 + 1);
+    memset(irq_label, 0, rows * 16);
+    fresh = 1;
+  }
+
+  /* cpu numbers, they have holes if some are offline */
+  c = 0;
+  for (l = irq_buf; *l && *l != '\n' && c < cols; ) {
+    if (strncmp(l, "CPU", 3) == 0) {
+      irq_col_cpu[c] = atoi(l + 3);
+      if ((unsigned int) irq_col_cpu[c] >= max_cpu)
+        max_cpu = irq_col_cpu[c] + 1;
+      c++;
+    }
+    while (*l && *l != '\n' && *l != ' ')
+      l++;
+    while (*l == ' ')
+      l++;
+  }
+  l = strchr(irq_buf, '\n');
+
+  for (r = 0; r < rows && l; r++) {
+    unsigned long long *row = irq_counts + r * cols;
+    char label[16], *name;
+
+    l++;
+    while (*l == ' ')
+      l++;
+    for (i=0; i<15 && l[i] && l[i] != ':' && l[i] != '\n'; i++)
+      label[i] = l[i];
+    label[i] = '\0';
+    l += i;
+    if (*l == ':')
+      l++;
+
+    /* lines moved, irq was added or removed */
+    if (strcmp(label, irq_label[r]) != 0) {
+      strcpy(irq_label[r], label);
+      fresh = 1;
+    }
+
+    for (c = 0; c < cols; c++) {
+      row[c] = strtoull(l, &e, 10);
+      if (e == l)
+        break;
+      l = e;
+    }
+
+    /* ERR and MIS have only one count, they aren't per cpu */
+    if (c < cols)
+      memset(row, 0, cols * sizeof(unsigned long long));
+
+    while (*l == ' ')
+      l++;
+    e = strchr(l, '\n');
+    if (e)
+      *e = '\0';
+
+    /* last word of numbered irq is device, like eth0-TxRx-0 */
+    name = l;
+    if (isdigit(label[0]) && strrchr(l, ' '))
+      name = strrchr(l, ' ') + 1;
+    snprintf(irq_name[r], 32, "%s", name);
+
+    l = e;
+  }
+
+  delta = current_update_time - last_irq_update;
+  last_irq_update = current_update_time;
+
+  if (max_cpu > info.irq_cpus) {
+    info.irq_cpu = (float *) realloc(info.irq_cpu, max_cpu * sizeof(float));
+    info.irq_cpus = max_cpu;
+  }
+  memset(info.irq_cpu, 0, info.irq_cpus * sizeof(float));
+  memset(info.irq_top, 0, sizeof(info.irq_top));
+  info.mask |= (1 << INFO_IRQ);
+
+  if (fresh || delta <= 0.001) {
+    t = irq_last;
+    irq_last = irq_counts;
+    irq_counts = t;
+    return;
+  }
+
+  /* irq_last becomes difference to last time */
+  for (i = 0; i < rows * cols; i++)
+    irq_last[i] = irq_counts[i] - irq_last[i];
+
+  memset(irq_cpu_sum, 0, cols * sizeof(unsigned long long));
+  for (r = 0; r < rows; r++) {
+    unsigned long long *row = irq_last + r * cols, sum = 0;
+
+    for (c = 0; c < cols; c++) {
+      sum += row[c];
+      irq_cpu_sum[c] += row[c];
+    }
+    irq_sum[r] = sum;
+  }
+
+  for (r = 0; r < rows; r++) {
+    if (irq_sum[r])
+      irq_top_add(r, irq_sum[r] / delta);
+  }
+  for (c = 0; c < cols; c++)
+    info.irq_cpu[irq_col_cpu[c]] = irq_cpu_sum[c] / delta;
+
+  t = irq_last;
+  irq_last = irq_counts;
+  irq_counts = t;
+}
+
+/* /proc/schedstat
+ *
+ * "cpuN" lines have time spent running and waiting in run queue in
+ * nanoseconds since boot, lines of scheduler domains are skipped */
+
+static int schedstat_fd = -1;
+static char *schedstat_buf;
+static unsigned int schedstat_buf_size;
+static unsigned long long *last_run_delay;
+static unsigned int last_run_delay_count;
+static double last_schedstat_update;
+
+/* cores.count is highest cpu number + 1 */
+static void grow_cores(unsigned int count) {
+  unsigned int i;
+
+  if (count <= info.cores.count)
+    return;
+
+  info.cores.runq_latency = (float *) realloc(info.cores.runq_latency,
+      count * sizeof(float));
+  info.cores.freq = (float *) realloc(info.cores.freq,
+      count * sizeof(float));
+  for (i=info.cores.count; i<count; i++) {
+    info.cores.runq_latency[i] = 0;
+    info.cores.freq[i] = 0;
+  }
+
+  info.cores.count = count;
+}
+
+void update_schedstat() {
+  static int rep;
+  unsigned int cpu;
+  double delta;
+  char *l;
+
+  if (schedstat_fd < 0) {
+    schedstat_fd = open("/proc/schedstat", O_RDONLY | O_CLOEXEC);
+    if (schedstat_fd < 0) {
+      if (!rep) {
+        ERR("can't open /proc/schedstat: %s", strerror(errno));
+        rep = 1;
+      }
+      return;
+    }
+  }
+  if (pread_all(schedstat_fd, &schedstat_buf, &schedstat_buf_size) <= 0)
+    return;
+
+  delta = current_update_time - last_schedstat_update;
+  last_schedstat_update = current_update_time;
+
+  for (l = schedstat_buf; l; l = strchr(l, '\n') ? strchr(l, '\n') + 1 : 0) {
+    unsigned long long run_delay;
+
+    /* cpuN yld_count 0 sched_count sched_goidle ttwu_count ttwu_local
+     * rq_cpu_time run_delay pcount */
+    if (strncmp(l, "cpu", 3) != 0 || sscanf(l + 3,
+          "%u %*u %*u %*u %*u %*u %*u %*u %Lu", &cpu, &run_delay) != 2)
+      continue;
+
+    grow_cores(cpu + 1);
+    if (cpu >= last_run_delay_count) {
+      last_run_delay = (unsigned long long *) realloc(last_run_delay,
+          (cpu + 1) * sizeof(unsigned long long));
+      memset(last_run_delay + last_run_delay_count, 0,
+          (cpu + 1 - last_run_delay_count) * sizeof(unsigned long long));
+      last_run_delay_count = cpu + 1;
+    }
+
+    if (last_run_delay[cpu] && delta > 0.001)
+      info.cores.runq_latency[cpu] =
+        (run_delay - last_run_delay[cpu]) / 1000000.0 / delta;
+    last_run_delay[cpu] = run_delay;
+  }
+
+  info.mask |= (1 << INFO_SCHED);
+}
+
+/* cpu frequencies from cpufreq in sysfs, files of each cpu are opened
+ * once. Without cpufreq (like in virtual machines) "cpu MHz" lines of
+ * /proc/cpuinfo are used. */
+
+#define CPU_DIR "/sys/devices/system/cpu"
+
+static int freq_opened;
+static unsigned int freq_cpus;
+static int *freq_fd, *core_throttle_fd, *package_throttle_fd;
+static int have_cpufreq;
+
+static int cpuinfo_fd = -1;
+static char *cpuinfo_buf;
+static unsigned int cpuinfo_buf_size;
+
+static int open_cpu_file(unsigned int cpu, const char *file) {
+  char path[128];
+  int fd, n;
+
+  snprintf(path, 128, CPU_DIR "/cpu%u/%s", cpu, file);
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+
+  /* out of the way of select() when there are hundreds of cpus */
+  if (fd >= 0 && (n = keep_proc_fd(fd)) >= 0) {
+    close(fd);
+    fd = n;
+  }
+  return fd;
+}
+
+/* number in a sysfs file, -1 if it can't be read */
+static long long read_cpu_value(int fd) {
+  char buf[32];
+
+  if (pread_file(fd, buf, sizeof(buf)) <= 0)
+    return -1;
+  return strtoll(buf, 0, 10);
+}
+
+/* highest cpu number + 1, offline cpus are counted too */
+static unsigned int count_cpus() {
+  unsigned int cpu, count = 0;
+  struct dirent *de;
+  DIR *dir;
+
+  dir = opendir(CPU_DIR);
+  if (dir == NULL) {
+    ERR("can't open " CPU_DIR ": %s", strerror(errno));
+    return 0;
+  }
+  while ((de = readdir(dir)) != NULL) {
+    if (sscanf(de->d_name, "cpu%u", &cpu) == 1 && cpu >= count)
+      count = cpu + 1;
+  }
+  closedir(dir);
+
+  return count;
+}
+
+static void open_freq_files() {
+  unsigned int cpu, i;
+  int *package;
+
+  freq_opened = 1;
+
+  freq_cpus = count_cpus();
+  grow_cores(freq_cpus);
+  freq_fd = (int *) malloc(freq_cpus * sizeof(int) + 1);
+  core_throttle_fd = (int *) malloc(freq_cpus * sizeof(int) + 1);
+  package_throttle_fd = (int *) malloc(freq_cpus * sizeof(int) + 1);
+  package = (int *) malloc(freq_cpus * sizeof(int) + 1);
+
+  for (cpu=0; cpu<freq_cpus; cpu++) {
+    char path[128], buf[32];
+
+    freq_fd[cpu] = open_cpu_file(cpu, "cpufreq/scaling_cur_freq");
+    if (freq_fd[cpu] >= 0)
+      have_cpufreq = 1;
+    core_throttle_fd[cpu] =
+      open_cpu_file(cpu, "thermal_throttle/core_throttle_count");
+
+    /* package count is same in every cpu of it, id is read only once so
+     * it isn't opened with open_cpu_file() */
+    snprintf(path, 128, CPU_DIR "/cpu%u/topology/physical_package_id", cpu);
+    package[cpu] = read_sysfs_line(path, buf, sizeof(buf)) ? atoi(buf) : -1;
+    for (i=0; i<cpu && package[i] != package[cpu]; i++)
+      ;
+    package_throttle_fd[cpu] = i < cpu ? -1 :
+      open_cpu_file(cpu, "thermal_throttle/package_throttle_count");
+  }
+
+  free(package);
+}
+
+static void read_cpuinfo_freq() {
+  static int rep;
+  unsigned int cpu = 0;
+  char *l;
+
+  if (cpuinfo_fd < 0) {
+    cpuinfo_fd = open("/proc/cpuinfo", O_RDONLY | O_CLOEXEC);
+    if (cpuinfo_fd < 0) {
+      if (!rep) {
+        ERR("can't open /proc/cpuinfo: %s", strerror(errno));
+        rep = 1;
+      }
+      return;
+    }
+  }
+  if (pread_all(cpuinfo_fd, &cpuinfo_buf, &cpuinfo_buf_size) <= 0)
+    return;
+
+  for (l = cpuinfo_buf; l; l = strchr(l, '\n') ? strchr(l, '\n') + 1 : 0) {
+    if (strncmp(l, "processor", 9) == 0 && strchr(l, ':'))
+      cpu = atoi(strchr(l, ':') + 1);
+    else if (strncmp(l, "cpu MHz", 7) == 0 && strchr(l, ':')) {
+      grow_cores(cpu + 1);
+      info.cores.freq[cpu] = atof(strchr(l, ':') + 1);
+    }
+  }
+}
+
+void update_freq() {
+  unsigned long long throttle = 0;
+  unsigned int cpu;
+  long long v;
+
+  if (!freq_opened)
+    open_freq_files();
+
+  if (!have_cpufreq)
+    read_cpuinfo_freq();
+
+  for (cpu=0; cpu<freq_cpus; cpu++) {
+    if (have_cpufreq) {
+      /* offline cpu can't be read */
+      v = read_cpu_value(freq_fd[cpu]);
+      info.cores.freq[cpu] = v > 0 ? v / 1000.0 : 0;
+    }
+
+    if ((v = read_cpu_value(core_throttle_fd[cpu])) > 0)
+      throttle += v;
+    if ((v = read_cpu_value(package_throttle_fd[cpu])) > 0)
+      throttle += v;
+  }
+
+  info.throttle_count = throttle;
+  info.mask |= (1 << INFO_FREQ);
+}
+
+/* idle states of cpus from cpuidle in sysfs, states are matched by name
+ * because cpus may not have same states */
+
+static struct cstate cstates[MAX_CSTATES];
+static unsigned int cstate_count;
+static int cstates_opened;
+static unsigned int cstate_cpus;
+static double last_cstate_update;
+
+/* by cpu number */
+static struct cstate_files {
+  int *time_fd, *usage_fd;
+  unsigned long long *last_time, *last_usage;
+} cstate_files[MAX_CSTATES];
+
+struct cstate *get_cstate(const char *name) {
+  unsigned int i;
+
+  for (i=0; i<cstate_count; i++) {
+    if (strcmp(cstates[i].name, name) == 0)
+      return &cstates[i];
+  }
+
+  if (cstate_count >= MAX_CSTATES) {
+    ERR("too many idle states (limit is %d)", MAX_CSTATES);
+    return 0;
+  }
+
+  memset(&cstates[i], 0, sizeof(struct cstate));
+  snprintf(cstates[i].name, 16, "%s", name);
+  cstate_count++;
+  cstates_opened = 0;
+
+  return &cstates[i];
+}
+
+static void close_cstate_files() {
+  unsigned int i, cpu;
+
+  for (i=0; i<MAX_CSTATES; i++) {
+    struct cstate_files *f = &cstate_files[i];
+
+    for (cpu=0; f->time_fd && cpu<cstate_cpus; cpu++) {
+      release_proc_fd(f->time_fd[cpu]);
+      release_proc_fd(f->usage_fd[cpu]);
+    }
+    free(f->time_fd);
+    free(f->usage_fd);
+    free(f->last_time);
+    free(f->last_usage);
+    memset(f, 0, sizeof(struct cstate_files));
+  }
+}
+
+void clear_cstates() {
+  unsigned int i;
+
+  close_cstate_files();
+  for (i=0; i<cstate_count; i++) {
+    free(cstates[i].cpu_residency);
+    free(cstates[i].cpu_usage);
+  }
+  cstate_count = 0;
+  cstates_opened = 0;
+}
+
+static void open_cstate_files() {
+  unsigned int i, cpu, k;
+
+  close_cstate_files();
+  cstates_opened = 1;
+  cstate_cpus = count_cpus();
+
+  for (i=0; i<cstate_count; i++) {
+    struct cstate_files *f = &cstate_files[i];
+
+    f->time_fd = (int *) malloc(cstate_cpus * sizeof(int) + 1);
+    f->usage_fd = (int *) malloc(cstate_cpus * sizeof(int) + 1);
+    f->last_time = (unsigned long long *) calloc(cstate_cpus + 1,
+        sizeof(unsigned long long));
+    f->last_usage = (unsigned long long *) calloc(cstate_cpus + 1,
+        sizeof(unsigned long long));
+    for (cpu=0; cpu<cstate_cpus; cpu++)
+      f->time_fd[cpu] = f->usage_fd[cpu] = -1;
+
+    free(cstates[i].cpu_residency);
+    free(cstates[i].cpu_usage);
+    cstates[i].cpu_residency = (float *) calloc(cstate_cpus + 1,
+        sizeof(float));
+    cstates[i].cpu_usage = (float *) calloc(cstate_cpus + 1, sizeof(float));
+    cstates[i].cpus = cstate_cpus;
+  }
+
+  for (cpu=0; cpu<cstate_cpus; cpu++) {
+    for (k=0; ; k++) {
+      char file[64], path[128], name[16];
+
+      /* name is read only once, it isn't kept open */
+      snprintf(path, 128, CPU_DIR "/cpu%u/cpuidle/state%u/name", cpu, k);
+      if (!read_sysfs_line(path, name, sizeof(name))) {
+        /* no more states, but an empty name doesn't end them */
+        if (access(path, F_OK) != 0)
+          break;
+        continue;
+      }
+
+      /* first word, some drivers have names like "haltpoll idle" */
+      name[strcspn(name, " ")] = '\0';
+
+      for (i=0; i<cstate_count; i++) {
+        if (strcmp(cstates[i].name, name) == 0) {
+          snprintf(file, 64, "cpuidle/state%u/time", k);
+          cstate_files[i].time_fd[cpu] = open_cpu_file(cpu, file);
+          snprintf(file, 64, "cpuidle/state%u/usage", k);
+          cstate_files[i].usage_fd[cpu] = open_cpu_file(cpu, file);
+          break;
+        }
+      }
+    }
+  }
+}
+
+void update_cstates() {
+  unsigned int i, cpu;
+  double delta;
+
+  if (!cstates_opened)
+    open_cstate_files();
+
+  delta = current_update_time - last_cstate_update;
+  last_cstate_update = current_update_time;
+
+  for (i=0; i<cstate_count; i++) {
+    struct cstate *c = &cstates[i];
+    struct cstate_files *f = &cstate_files[i];
+    float residency = 0, usage = 0;
+    unsigned int cpus = 0;
+
+    for (cpu=0; cpu<cstate_cpus; cpu++) {
+      /* time is in microseconds */
+      long long t = read_cpu_value(f->time_fd[cpu]);
+      long long u = read_cpu_value(f->usage_fd[cpu]);
+
+      if (t < 0 || u < 0)
+        continue;
+
+      if (f->last_time[cpu] && delta > 0.001) {
+        c->cpu_residency[cpu] = (t - f->last_time[cpu]) / delta / 10000.0;
+        c->cpu_usage[cpu] = (u - f->last_usage[cpu]) / delta;
+      }
+      f->last_time[cpu] = t;
+      f->last_usage[cpu] = u;
+
+      residency += c->cpu_residency[cpu];
+      usage += c->cpu_usage[cpu];
+      cpus++;
+    }
+
+    c->residency = cpus ? residency / cpus : 0;
+    c->usage = usage;
+  }
+
+  info.mask |= (1 << INFO_CSTATE);
+}
+
+/* RAPL energy counters from powercap
+ *
+ * Domains are intel-rapl:N (package-N) and intel-rapl:N:M (core, uncore,
+ * dram). energy_uj of each package and dram domain is kept open, counter
+ * wraps at max_energy_range_uj. */
+
+char *powercap_dir;
+
+enum {
+  RAPL_PKG,
+  RAPL_DRAM,
+};
+
+struct rapl_domain {
+  int type;
+  int fd;
+  unsigned long long max_range;
+  unsigned long long last;
+  int valid;
+  struct rapl_domain *next;
+};
+
+static struct rapl_domain *rapl_domains;
+static int rapl_scanned;
+static double last_rapl_update;
+
+/* makes path of file in powercap domain, 0 if it doesn't fit */
+static int rapl_path(char *path, const char *dir, const char *name,
+    const char *file) {
+  return snprintf(path, 256, "%s/%s/%s", dir, name, file) < 256;
+}
+
+static void scan_rapl() {
+  static int rep;
+  const char *dir = powercap_dir ? powercap_dir : "/sys/class/powercap";
+  struct dirent **namelist;
+  char path[256], buf[32];
+  int i, n;
+
+  rapl_scanned = 1;
+
+  n = scandir(dir, &namelist, no_dots, alphasort);
+  if (n < 0) {
+    if (!rep) {
+      ERR("scandir for %s: %s", dir, strerror(errno));
+      rep = 1;
+    }
+    return;
+  }
+
+  for (i=0; i<n; i++) {
+    struct rapl_domain *r;
+    const char *name = namelist[i]->d_name;
+    int type = -1, fd;
+
+    /* intel-rapl-mmio has packages again */
+    if (strncmp(name, "intel-rapl:", 11) == 0 &&
+        rapl_path(path, dir, name, "name")) {
+      if (read_sysfs_line(path, buf, sizeof(buf))) {
+        if (strncmp(buf, "package", 7) == 0)
+          type = RAPL_PKG;
+        else if (strcmp(buf, "dram") == 0)
+          type = RAPL_DRAM;
+      }
+    }
+
+    if (type >= 0 && rapl_path(path, dir, name, "energy_uj")) {
+      /* only root can read energy_uj on new kernels */
+      fd = open(path, O_RDONLY | O_CLOEXEC);
+      if (fd < 0)
+        ERR("can't open '%s': %s", path, strerror(errno));
+      else if (read_cpu_value(fd) < 0) {
+        ERR("can't read '%s'", path);
+        close(fd);
+      }
+      else {
+        r = (struct rapl_domain *) calloc(1, sizeof(struct rapl_domain));
+        r->type = type;
+        r->fd = fd;
+        if (rapl_path(path, dir, name, "max_energy_range_uj") &&
+            read_sysfs_line(path, buf, sizeof(buf)))
+          r->max_range = strtoull(buf, 0, 10);
+        r->next = rapl_domains;
+        rapl_domains = r;
+      }
+    }
+
+    free(namelist[i]);
+  }
+  free(namelist);
+}
+
+void clear_rapl() {
+  while (rapl_domains) {
+    struct rapl_domain *r = rapl_domains;
+
+    rapl_domains = r->next;
+    close(r->fd);
+    free(r);
+  }
+  rapl_scanned = 0;
+  info.energy_total = 0;
+}
+
+void update_rapl() {
+  struct rapl_domain *r;
+  double delta, power[2] = { 0, 0 };
+
+  if (!rapl_scanned)
+    scan_rapl();
+
+  delta = current_update_time - last_rapl_update;
+  last_rapl_update = current_update_time;
+
+  for (r = rapl_domains; r; r = r->next) {
+    long long v = read_cpu_value(r->fd);
+    unsigned long long e, d;
+
+    if (v < 0)
+      continue;
+    e = v;
+
+    /* counter wraps at max_range, sample is skipped if it isn't known */
+    if (r->valid && (e >= r->last || r->max_range >= r->last)) {
+      if (e >= r->last)
+        d = e - r->last;
+      else
+        d = r->max_range - r->last + e;
 
-      /* it seemed to buffer it so file must be closed (or could use syscalls
-       * directly but I don't feel like coding it now) */
-      fclose(apm_bat_fp);
-      apm_bat_fp = NULL;
+      info.energy_total += d / 1000000.0;
+      if (delta > 0.001)
+        power[r->type] += d / 1000000.0 / delta;
     }
+    r->last = e;
+    r->valid = 1;
   }
 
-  snprintf(buf, n, "%s", last_battery_str);
+  info.power_pkg = power[RAPL_PKG];
+  info.power_dram = power[RAPL_DRAM];
+  info.mask |= (1 << INFO_RAPL);
 }
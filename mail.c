@@ -1,162 +1,1011 @@
 #include "torsmo.h"
 #include <stdio.h>
+#include <stdarg.h>
 #include <string.h>
+#include <ctype.h>
 #include <errno.h>
 #include <sys/time.h>
 #include <sys/stat.h>
 #include <dirent.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
 
 char *current_mail_spool;
 
-static time_t last_mail_mtime;
-static double last_mail_update;
+/* every different spool that is used in text */
+static struct mail_spool *mail_spools;
 
-void update_mail_count() {
-  struct stat buf;
+static void clear_imap_mailboxes();
+
+#ifdef HAVE_SYS_INOTIFY_H
+
+/* spools are watched with one inotify instance when possible, then a spool
+ * is scanned right after something has changed in it and main_loop() is
+ * woken up only if counts changed (scanning is done in main loop, it's cheap
+ * as mbox is read only from where last scan stopped and maildir only when
+ * events have been lost) */
+
+static int mail_inotify_fd = -1;
+
+/* maildir that has just been scanned, its events can't be counted */
+static struct mail_spool *scanned_spool;
+
+static int maildir_message(struct mail_spool *m, const char *name, int n);
+static void update_mail_spool(struct mail_spool *m);
+
+/* different paths to same file get the same watch descriptor */
+static int mail_wd_shared(struct mail_spool *self, int wd) {
+  struct mail_spool *m;
+
+  for (m = mail_spools; m; m = m->next) {
+    if (m != self && (m->wd[0] == wd || m->wd[1] == wd))
+      return 1;
+  }
+
+  return 0;
+}
+
+static void unwatch_mail_spool(struct mail_spool *m) {
+  unsigned int i;
+
+  for (i=0; i<2; i++) {
+    if (m->wd[i] >= 0 && mail_inotify_fd >= 0 &&
+        !mail_wd_shared(m, m->wd[i]))
+      inotify_rm_watch(mail_inotify_fd, m->wd[i]);
+    m->wd[i] = -1;
+  }
+
+  m->watched = 0;
+}
+
+/* returns 1 if counts of some spool changed */
+static int mail_event(int wd, unsigned int mask, const char *name) {
+  struct mail_spool *m;
+  int r = 0;
+
+  for (m = mail_spools; m; m = m->next) {
+    if (m->wd[0] != wd && m->wd[1] != wd)
+      continue;
+
+    /* maildir counts are kept up to date from file names, no rescan */
+    if (m->maildir) {
+      /* came while scanning, scan may or may not have seen the file */
+      if (m == scanned_spool)
+        m->changed = 1;
+      else if (mask & IN_ISDIR)
+        ;
+      else if (mask & (IN_CREATE | IN_MOVED_TO))
+        r |= maildir_message(m, name, 1);
+      else if (mask & (IN_DELETE | IN_MOVED_FROM))
+        r |= maildir_message(m, name, -1);
+    }
+    else
+      m->changed = 1;
+
+    /* mbox was removed or replaced by rename(), watch is added again and
+     * spool scanned right away */
+    if (mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) {
+      if (m->wd[0] == wd) m->wd[0] = -1;
+      if (m->wd[1] == wd) m->wd[1] = -1;
+      unwatch_mail_spool(m);
+      m->last_update = 0;
+    }
+  }
+
+  return r;
+}
+
+/* returns 1 if counts of some spool changed */
+static int read_mail_events(int fd) {
+  char buf[4096];
+  int n, r = 0;
+
+  while ((n = read(fd, buf, sizeof(buf))) > 0) {
+    char *p = buf;
+
+    while (p < buf + n) {
+      struct inotify_event *ev = (struct inotify_event *) p;
+
+      /* events were lost, check everything */
+      if (ev->mask & IN_Q_OVERFLOW) {
+        struct mail_spool *m;
+        for (m = mail_spools; m; m = m->next)
+          m->changed = 1;
+      }
+      else
+        r |= mail_event(ev->wd, ev->mask, ev->len ? ev->name : "");
+
+      p += sizeof(struct inotify_event) + ev->len;
+    }
+  }
+
+  return r;
+}
+
+/* changed mbox (and maildir that lost events) is scanned here, so text is
+ * updated only when some count really changes and not on every write */
+static int mail_notify_handler(int fd) {
+  struct mail_spool *m;
+  int r = read_mail_events(fd);
+
+  for (m = mail_spools; m; m = m->next) {
+    int count = m->mail_count, new_count = m->new_mail_count;
+
+    if (!m->watched || !m->changed)
+      continue;
+
+    update_mail_spool(m);
+    if (m->mail_count != count || m->new_mail_count != new_count)
+      r = 1;
+  }
+
+  return r;
+}
 
-  if (current_mail_spool == NULL) return;
+static void watch_mail_spool(struct mail_spool *m, int maildir) {
+  unwatch_mail_spool(m);
+
+  if (mail_inotify_fd < 0) {
+    mail_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (mail_inotify_fd < 0)
+      return;
+    add_update_fd(mail_inotify_fd, mail_notify_handler);
+  }
 
-  /* TODO: use that fine file modification notify on Linux 2.4 */
+  if (maildir) {
+    char path[512];
+    unsigned int mask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO;
 
-  /* don't check mail so often (9.5s is minimum interval) */
-  if (current_update_time - last_mail_update < 9.5)
+    snprintf(path, 512, "%s/cur", m->path);
+    m->wd[0] = inotify_add_watch(mail_inotify_fd, path, mask);
+    snprintf(path, 512, "%s/new", m->path);
+    m->wd[1] = inotify_add_watch(mail_inotify_fd, path, mask);
+  }
+  else {
+    m->wd[0] = inotify_add_watch(mail_inotify_fd, m->path,
+        IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_DELETE_SELF |
+        IN_MOVE_SELF);
+  }
+
+  /* falls back to polling */
+  if (m->wd[0] < 0 || (maildir && m->wd[1] < 0)) {
+    unwatch_mail_spool(m);
     return;
+  }
+
+  m->watched = 1;
+  m->maildir = maildir;
+}
+
+#endif /* HAVE_SYS_INOTIFY_H */
+
+/* returns spool for path, spools with the same path are shared */
+struct mail_spool *get_mail_spool(const char *path) {
+  struct mail_spool *m;
+  char buf[256];
+
+  if (path == NULL)
+    return 0;
+
+  variable_substitute(path, buf, 256);
+  if (buf[0] == '\0')
+    return 0;
+
+  for (m = mail_spools; m; m = m->next) {
+    if (strcmp(m->path, buf) == 0)
+      return m;
+  }
+
+  m = (struct mail_spool *) calloc(1, sizeof(struct mail_spool));
+  m->path = strdup(buf);
+  m->wd[0] = m->wd[1] = -1;
+  m->next = mail_spools;
+  mail_spools = m;
+
+  return m;
+}
+
+void clear_mail_spools() {
+  while (mail_spools) {
+    struct mail_spool *m = mail_spools;
+    mail_spools = m->next;
+
+#ifdef HAVE_SYS_INOTIFY_H
+    unwatch_mail_spool(m);
+#endif
+    free(m->path);
+    free(m);
+  }
+
+  clear_imap_mailboxes();
+}
+
+/* mbox is scanned only from where the last scan stopped if the file has just
+ * grown, which is found out by checking samples of already scanned part */
+
+#define MBOX_SAMPLE 4096
+#define MBOX_CHUNK 65536
+
+static unsigned int mbox_checksum(int fd, off_t offset) {
+  char buf[MBOX_SAMPLE];
+  unsigned int h = 2166136261U; /* FNV-1a */
+  off_t at[2];
+  int i, j, n;
+
+  /* from the beginning and from the end of scanned part */
+  at[0] = 0;
+  at[1] = offset > MBOX_SAMPLE ? offset - MBOX_SAMPLE : 0;
+
+  for (i=0; i<2; i++) {
+    n = pread(fd, buf, offset < MBOX_SAMPLE ? offset : MBOX_SAMPLE, at[i]);
+    for (j=0; j<n; j++)
+      h = (h ^ (unsigned char) buf[j]) * 16777619U;
+  }
+
+  return h;
+}
+
+static void parse_mbox_line(struct mbox_scan *s, const char *l,
+    unsigned int len) {
+  if (len >= 5 && memcmp(l, "From ", 5) == 0) {
+    /* ignore MAILER-DAEMON */
+    if (len < 19 || memcmp(l+5, "MAILER-DAEMON ", 14) != 0) {
+      s->mail_count++;
+
+      if (s->reading_status)
+        s->new_mail_count++;
+      else
+        s->reading_status = 1;
+    }
+  }
+  else if (s->reading_status) {
+    if (len >= 17 && memcmp(l, "X-Mozilla-Status:", 17) == 0) {
+      /* check that mail isn't already read */
+      if (len > 21 && memchr(l+21, '0', len-21))
+        s->new_mail_count++;
+
+      s->reading_status = 0;
+    }
+    else if (len >= 7 && memcmp(l, "Status:", 7) == 0) {
+      /* check that mail isn't already read */
+      if (memchr(l+7, 'R', len-7) == NULL)
+        s->new_mail_count++;
+
+      s->reading_status = 0;
+    }
+  }
+}
+
+/* returns 0 if mbox couldn't be read, new part is read with pread() as
+ * mmap() would get SIGBUS if mail client truncated the file meanwhile */
+static int scan_mbox(struct mail_spool *m) {
+  static char buf[MBOX_CHUNK];
+  struct mbox_scan *s = &m->mbox;
+  struct stat st;
+  off_t pos;
+  unsigned int len = 0;
+  int fd, n;
+
+  fd = open(m->path, O_RDONLY);
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    if (!m->rep) {
+      ERR("can't open %s: %s", m->path, strerror(errno));
+      m->rep = 1;
+    }
+    if (fd >= 0) close(fd);
+    return 0;
+  }
+
+  /* start from scratch if file was truncated or rewritten */
+  if (st.st_size < s->offset || mbox_checksum(fd, s->offset) != s->sum)
+    memset(s, 0, sizeof(*s));
+
+  if (st.st_size == s->offset) {
+    close(fd);
+    return 1;
+  }
+
+  pos = s->offset;
+  while ((n = pread(fd, buf + len, MBOX_CHUNK - len, pos)) > 0) {
+    char *p = buf, *end, *nl;
+
+    pos += n;
+    len += n;
+    end = buf + len;
+
+    /* only complete lines, rest is parsed when there's more */
+    while ((nl = memchr(p, '\n', end - p)) != NULL) {
+      parse_mbox_line(s, p, nl - p);
+      p = nl + 1;
+      s->offset = pos - (end - p);
+    }
+
+    len = end - p;
+    memmove(buf, p, len);
+
+    /* beginning of too long line is enough for parse_mbox_line() */
+    if (len == MBOX_CHUNK)
+      len = 256;
+  }
+
+  s->sum = mbox_checksum(fd, s->offset);
+  close(fd);
+
+  return 1;
+}
+
+/* maildir message has been read if there is S in its info, like in
+ * "unique:2,RS", messages in new/ have no info */
+static int maildir_seen(const char *name) {
+  const char *info = strstr(name, ":2,");
+  return info && strchr(info + 3, 'S');
+}
+
+/* adds (n = 1) or removes (n = -1) message from spool's counts, returns 0
+ * if name isn't a message */
+static int maildir_message(struct mail_spool *m, const char *name, int n) {
+  /* . and .. and dot files are skipped */
+  if (name[0] == '.' || name[0] == '\0')
+    return 0;
+
+  m->mail_count += n;
+  if (!maildir_seen(name))
+    m->new_mail_count += n;
+
+  /* some event was missed, count again */
+  if (m->mail_count < 0 || m->new_mail_count < 0)
+    m->changed = 1;
+
+  return 1;
+}
+
+#if defined(__linux__) && defined(SYS_getdents64)
+
+/* large maildirs are read with few getdents64() calls */
+
+static int scan_maildir_dir(struct mail_spool *m, const char *sub) {
+  static char *buf;
+  const int buf_size = 256*1024;
+  char path[512];
+  int fd, n;
+
+  snprintf(path, 512, "%s/%s", m->path, sub);
+
+  fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) {
+    ERR("cannot open directory %s: %s", path, strerror(errno));
+    return -1;
+  }
+
+  if (buf == NULL) {
+    buf = (char *) malloc(buf_size);
+    if (buf == NULL) {
+      ERR("malloc: %s", strerror(errno));
+      close(fd);
+      return -1;
+    }
+  }
+
+  while ((n = syscall(SYS_getdents64, fd, buf, buf_size)) > 0) {
+    int i;
+
+    for (i=0; i<n; ) {
+      struct linux_dirent64 *d = (struct linux_dirent64 *) (buf + i);
+
+      if (d->d_type != DT_DIR)
+        maildir_message(m, d->d_name, 1);
+      i += d->d_reclen;
+    }
+  }
+
+  close(fd);
+  return n < 0 ? -1 : 0;
+}
+
+#else
+
+static int scan_maildir_dir(struct mail_spool *m, const char *sub) {
+  char path[512];
+  struct dirent *dirent;
+  DIR *d;
+
+  snprintf(path, 512, "%s/%s", m->path, sub);
+
+  d = opendir(path);
+  if (!d) {
+    ERR("cannot open directory %s: %s", path, strerror(errno));
+    return -1;
+  }
+
+  while ((dirent = readdir(d)) != NULL)
+    maildir_message(m, dirent->d_name, 1);
+  closedir(d);
+
+  return 0;
+}
+
+#endif
+
+static void scan_maildir(struct mail_spool *m) {
+  int old_count = m->mail_count, old_new = m->new_mail_count;
+
+#ifdef HAVE_SYS_INOTIFY_H
+  /* events that came before scan are included in it */
+  if (m->watched)
+    read_mail_events(mail_inotify_fd);
+#endif
+
+  m->mail_count = m->new_mail_count = 0;
+  m->changed = 0;
+
+  if (scan_maildir_dir(m, "cur") < 0 || scan_maildir_dir(m, "new") < 0) {
+    m->mail_count = old_count;
+    m->new_mail_count = old_new;
+  }
+
+#ifdef HAVE_SYS_INOTIFY_H
+  /* messages that arrived during scan may have been counted already, so
+   * instead of counting them again the spool is scanned again */
+  if (m->watched) {
+    scanned_spool = m;
+    read_mail_events(mail_inotify_fd);
+    scanned_spool = NULL;
+  }
+#endif
+}
+
+static void update_mail_spool(struct mail_spool *m) {
+  struct stat buf;
+  int notified = 0;
+
+#ifdef HAVE_SYS_INOTIFY_H
+  if (m->watched) {
+    /* nothing to do while nothing changes */
+    if (!m->changed)
+      return;
+    m->changed = 0;
+    notified = 1;
+  }
   else
-    last_mail_update = current_update_time;
+#endif
+  {
+    /* don't check mail so often (9.5s is minimum interval) */
+    if (current_update_time - m->last_update < 9.5)
+      return;
+    else
+      m->last_update = current_update_time;
+  }
 
-  if (stat(current_mail_spool, &buf)) {
-    static int rep;
-    if (!rep) {
-      ERR("can't stat %s: %s", current_mail_spool, strerror(errno));
-      rep = 1;
+  if (stat(m->path, &buf)) {
+    if (!m->rep) {
+      ERR("can't stat %s: %s", m->path, strerror(errno));
+      m->rep = 1;
     }
     return;
   }
 
-#if HAVE_DIRENT_H
-  /* maildir format */
-	if (S_ISDIR(buf.st_mode)){
-		DIR *dir;
-		char *dirname;
-		struct dirent *dirent;
-		info.mail_count=0;
-		info.new_mail_count=0;
-
-		dirname=(char *)malloc(sizeof(char)*(strlen(current_mail_spool)+5));
-		if (!dirname){
-			ERR("malloc");
-			return;
-		}
-		strcpy(dirname,current_mail_spool);
-		strcat(dirname,"/");
-		/* checking the cur subdirectory */
-		strcat(dirname,"cur");
-
-		dir = opendir (dirname);
-		if (!dir){
-			ERR("cannot open directory");
-			free(dirname);
-			return ;
-		}
-		dirent = readdir (dir);
-		while(dirent) {
-			/* . and .. are skipped */
-			if (dirent->d_name[0] != '.'){
-				info.mail_count++;
-			}
-			dirent = readdir (dir);
-		}
-		closedir (dir);
-
-		dirname[strlen(dirname)-3]='\0';
-		strcat(dirname,"new");
-
-		dir = opendir (dirname);
-		if (!dir){
-			ERR("cannot open directory");
-			free(dirname);
-			return ;
-		}
-		dirent = readdir (dir);
-		while(dirent) {
-			/* . and .. are skipped */
-			if (dirent->d_name[0] != '.'){
-				info.new_mail_count++;
-				info.mail_count++;
-			}
-			dirent = readdir (dir);
-		}
-		closedir (dir);
-
-		free(dirname);
-		return;
-	}
+#ifdef HAVE_SYS_INOTIFY_H
+  /* watch is added before scanning so that nothing gets lost */
+  if (!notified)
+    watch_mail_spool(m, S_ISDIR(buf.st_mode));
 #endif
-	/* mbox format */
 
+  /* maildir format */
+  if (S_ISDIR(buf.st_mode)) {
+    scan_maildir(m);
+    return;
+  }
 
-  if (buf.st_mtime != last_mail_mtime) {
+  /* mbox format */
+  if (notified || buf.st_mtime != m->last_mtime) {
     /* yippee, modification time has changed, let's read mail count! */
-    static int rep;
-    FILE *fp;
-    int reading_status = 0;
 
     /* could lock here but I don't think it's really worth it because
      * this isn't going to write mail spool */
 
-    info.new_mail_count = 0;
-    info.mail_count = 0;
-
-    fp = open_file(current_mail_spool, &rep);
-    if (!fp) return;
+    if (!scan_mbox(m))
+      return;
 
+    m->mail_count = m->mbox.mail_count;
     /* NOTE: adds mail as new if there isn't Status-field at all */
+    m->new_mail_count = m->mbox.new_mail_count + m->mbox.reading_status;
+
+    m->last_mtime = buf.st_mtime;
+  }
+}
+
+/* IMAP mailboxes are followed with one connection per mailbox that is kept
+ * in IDLE, unseen messages are searched only after server tells that
+ * something has changed (or every minute if server has no IDLE) */
+
+/* imap_password configurations, account is "user@host" or NULL for the
+ * password of all other accounts */
+struct imap_password {
+  char *account;
+  char *password;
+  struct imap_password *next;
+};
+
+static struct imap_password *imap_passwords;
+
+static struct imap_mailbox *imap_mailboxes;
+
+static int imap_handler(int fd);
+
+/* value is "password" or "user@host password" */
+void add_imap_password(const char *value) {
+  struct imap_password *p;
+  const char *sp;
+
+  if (value == NULL)
+    return;
+
+  p = (struct imap_password *) calloc(1, sizeof(struct imap_password));
+
+  sp = strchr(value, ' ');
+  if (sp && memchr(value, '@', sp - value)) {
+    p->account = strndup(value, sp - value);
+    while (*sp == ' ') sp++;
+    p->password = strdup(sp);
+  }
+  else
+    p->password = strdup(value);
+
+  p->next = imap_passwords;
+  imap_passwords = p;
+}
+
+void clear_imap_passwords() {
+  while (imap_passwords) {
+    struct imap_password *p = imap_passwords;
+    imap_passwords = p->next;
+
+    free(p->account);
+    free(p->password);
+    free(p);
+  }
+}
+
+static const char *imap_mailbox_password(struct imap_mailbox *m) {
+  struct imap_password *p;
+  const char *r = "";
+  char account[256];
+
+  snprintf(account, 256, "%s@%s", m->user, m->host);
+
+  for (p = imap_passwords; p; p = p->next) {
+    if (p->account == NULL)
+      r = p->password;
+    else if (strcmp(p->account, account) == 0)
+      return p->password;
+  }
+
+  return r;
+}
+
+static void imap_set_state(struct imap_mailbox *m, int state) {
+  m->state = state;
+  m->state_time = get_time();
+}
+
+static void imap_disconnect(struct imap_mailbox *m) {
+  if (m->fd >= 0) {
+    remove_update_fd(m->fd);
+    close(m->fd);
+    m->fd = -1;
+  }
+  m->len = 0;
+  imap_set_state(m, IMAP_DISCONNECTED);
+}
+
+/* connection is tried again later, wait doubles up to 5 minutes */
+static void imap_fail(struct imap_mailbox *m, const char *why) {
+  if (!m->rep) {
+    ERR("imap %s@%s: %s", m->user, m->host, why);
+    m->rep = 1;
+  }
+
+  imap_disconnect(m);
+
+  m->retry_time = get_time() + m->backoff;
+  m->backoff = m->backoff < 150 ? m->backoff * 2 : 300;
+}
+
+static void imap_send(struct imap_mailbox *m, int state, const char *fmt,
+    ...) {
+  char buf[512];
+  va_list ap;
+  int n;
+
+  va_start(ap, fmt);
+  n = vsnprintf(buf, 510, fmt, ap);
+  va_end(ap);
+  if (n < 0 || n >= 510) {
+    imap_fail(m, "command too long");
+    return;
+  }
+  buf[n++] = '\r';
+  buf[n++] = '\n';
+
+  /* commands are short enough to always fit in socket buffer */
+  if (write(m->fd, buf, n) != n) {
+    imap_fail(m, "write failed");
+    return;
+  }
+
+  imap_set_state(m, state);
+}
+
+/* sends tagged command, tag is "t" + sequence number */
+#define IMAP_COMMAND(m, state, fmt, args...) \
+  imap_send(m, state, "t%d " fmt, ++(m)->tag , ## args)
+
+static void imap_search(struct imap_mailbox *m) {
+  m->search_count = 0;
+  IMAP_COMMAND(m, IMAP_SEARCH, "SEARCH UNSEEN");
+}
+
+/* counts message numbers of SEARCH reply */
+static int imap_count_numbers(const char *p) {
+  int n = 0;
+
+  while (*p) {
+    if (isdigit((int) *p)) {
+      n++;
+      while (isdigit((int) *p))
+        p++;
+    }
+    else
+      p++;
+  }
+
+  return n;
+}
+
+/* "* CAPABILITY IMAP4rev1 IDLE ..." */
+static int imap_has_idle(const char *l) {
+  char word[64];
+  int n;
+
+  l += 12;
+  while (sscanf(l, " %63s%n", word, &n) == 1) {
+    if (strcasecmp(word, "IDLE") == 0)
+      return 1;
+    l += n;
+  }
+
+  return 0;
+}
+
+/* quoted string for LOGIN and mailbox names */
+static const char *imap_quote(char *buf, unsigned int n, const char *s) {
+  unsigned int i = 0;
+
+  buf[i++] = '"';
+  while (*s && i < n - 3) {
+    if (*s == '"' || *s == '\\')
+      buf[i++] = '\\';
+    buf[i++] = *s++;
+  }
+  buf[i++] = '"';
+  buf[i] = '\0';
 
-    while (!feof(fp)) {
-      char buf[128];
-      if (fgets(buf, 128, fp) == NULL) break;
+  return buf;
+}
+
+static void imap_connect(struct imap_mailbox *m) {
+  struct addrinfo hints, *res, *ai;
+  int err;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+
+  /* NOTE: name lookup blocks, use address or local name in hosts */
+  err = getaddrinfo(m->host, m->port, &hints, &res);
+  if (err) {
+    imap_fail(m, gai_strerror(err));
+    return;
+  }
+
+  for (ai = res; ai; ai = ai->ai_next) {
+    m->fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK |
+        SOCK_CLOEXEC, ai->ai_protocol);
+    if (m->fd < 0)
+      continue;
 
-      if (strncmp(buf, "From ", 5) == 0) {
-        /* ignore MAILER-DAEMON */
-        if (strncmp(buf+5, "MAILER-DAEMON ", 14) != 0) {
-          info.mail_count++;
+    if (connect(m->fd, ai->ai_addr, ai->ai_addrlen) == 0 ||
+        errno == EINPROGRESS)
+      break;
 
-          if (reading_status)
-            info.new_mail_count++;
-          else
-            reading_status = 1;
-        }
+    close(m->fd);
+    m->fd = -1;
+  }
+  freeaddrinfo(res);
+
+  if (m->fd < 0) {
+    imap_fail(m, "can't connect");
+    return;
+  }
+
+  /* greeting or connect error makes socket readable */
+  add_update_fd(m->fd, imap_handler);
+  imap_set_state(m, IMAP_GREETING);
+}
+
+/* returns 1 if unseen count changed */
+static int imap_line(struct imap_mailbox *m, char *l) {
+  char q[2][256];
+  char tag[16];
+  int n;
+
+  snprintf(tag, 16, "t%d ", m->tag);
+
+  if (strncmp(l, "* BYE", 5) == 0) {
+    imap_fail(m, l);
+    return 0;
+  }
+
+  /* tagged reply to last command */
+  if (strncmp(l, tag, strlen(tag)) == 0) {
+    if (strncmp(l + strlen(tag), "OK", 2) != 0) {
+      imap_fail(m, l + strlen(tag));
+      return 0;
+    }
+
+    switch (m->state) {
+    case IMAP_LOGIN:
+      m->idle = 0;
+      IMAP_COMMAND(m, IMAP_CAPABILITY, "CAPABILITY");
+      break;
+
+    case IMAP_CAPABILITY:
+      /* read-only is enough */
+      IMAP_COMMAND(m, IMAP_EXAMINE, "EXAMINE %s",
+          imap_quote(q[0], 256, m->mailbox));
+      break;
+
+    case IMAP_EXAMINE:
+    case IMAP_DONE:
+      /* STATUS shouldn't be used for selected mailbox (RFC 3501) */
+      imap_search(m);
+      break;
+
+    case IMAP_SEARCH:
+      /* logged in and everything works */
+      m->backoff = 1;
+      m->rep = 0;
+      m->changed = 0;
+      if (m->idle)
+        IMAP_COMMAND(m, IMAP_IDLE_START, "IDLE");
+      else
+        imap_set_state(m, IMAP_POLL);
+      break;
+    }
+    return 0;
+  }
+
+  switch (m->state) {
+  case IMAP_GREETING:
+    if (strncmp(l, "* OK", 4) == 0)
+      IMAP_COMMAND(m, IMAP_LOGIN, "LOGIN %s %s",
+          imap_quote(q[0], 256, m->user),
+          imap_quote(q[1], 256, imap_mailbox_password(m)));
+    else if (strncmp(l, "* PREAUTH", 9) == 0)
+      IMAP_COMMAND(m, IMAP_LOGIN, "NOOP");
+    else
+      imap_fail(m, l);
+    break;
+
+  case IMAP_CAPABILITY:
+    if (strncmp(l, "* CAPABILITY ", 13) == 0)
+      m->idle = imap_has_idle(l);
+    break;
+
+  case IMAP_SEARCH:
+    if (strncmp(l, "* SEARCH", 8) == 0) {
+      n = m->search_count + imap_count_numbers(l + 8);
+      m->search_count = 0;
+
+      if (n != m->unseen) {
+        m->unseen = n;
+        return 1;
       }
-      else {
-        if (reading_status && strncmp(buf, "X-Mozilla-Status:", 17) == 0) {
-          /* check that mail isn't already read */
-          if (strchr(buf+21, '0'))
-            info.new_mail_count++;
-
-          reading_status = 0;
-          continue;
-        }
-        if (reading_status && strncmp(buf, "Status:", 7) == 0) {
-          /* check that mail isn't already read */
-          if (strchr(buf+7, 'R') == NULL)
-            info.new_mail_count++;
-
-          reading_status = 0;
-          continue;
-        }
+    }
+    break;
+
+  case IMAP_IDLE_START:
+  case IMAP_IDLE:
+    if (l[0] == '+') {
+      imap_set_state(m, IMAP_IDLE);
+      /* something happened before server was ready */
+      if (m->changed)
+        imap_send(m, IMAP_DONE, "DONE");
+    }
+    else {
+      /* "* 12 EXISTS" */
+      n = 0;
+      sscanf(l, "* %*d %n", &n);
+      if (n > 0 && (strncmp(l + n, "EXISTS", 6) == 0 ||
+            strncmp(l + n, "EXPUNGE", 7) == 0 ||
+            strncmp(l + n, "FETCH", 5) == 0)) {
+        m->changed = 1;
+        if (m->state == IMAP_IDLE)
+          imap_send(m, IMAP_DONE, "DONE");
       }
+    }
+    break;
+  }
+
+  return 0;
+}
+
+static int imap_handler(int fd) {
+  struct imap_mailbox *m;
+  int r = 0;
 
-      /* skip until \n */
-      while (strchr(buf, '\n') == NULL && !feof(fp))
-        fgets(buf, 128, fp);
+  for (m = imap_mailboxes; m; m = m->next) {
+    if (m->fd == fd)
+      break;
+  }
+  if (m == NULL)
+    return 0;
+
+  while (m->fd >= 0) {
+    char *p, *nl;
+    int n;
+
+    n = read(m->fd, m->buf + m->len, sizeof(m->buf) - 1 - m->len);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+      imap_fail(m, n == 0 ? "connection closed" : strerror(errno));
+      break;
+    }
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      break;
+    }
+
+    m->len += n;
+    m->buf[m->len] = '\0';
+
+    /* handles complete lines, connection may be closed while doing it */
+    p = m->buf;
+    while (m->fd >= 0 && (nl = strchr(p, '\n')) != NULL) {
+      *nl = '\0';
+      if (nl > p && nl[-1] == '\r')
+        nl[-1] = '\0';
+      r |= imap_line(m, p);
+      p = nl + 1;
+    }
+
+    if (m->fd < 0)
+      break;
+
+    m->len -= p - m->buf;
+    memmove(m->buf, p, m->len);
+    m->buf[m->len] = '\0';
+
+    /* too long line (like big literal) is dropped, except SEARCH reply
+     * which is counted in parts */
+    if (m->len >= sizeof(m->buf) - 1) {
+      char *sp = strrchr(m->buf, ' ');
+
+      if (m->state == IMAP_SEARCH && strncmp(m->buf, "* SEARCH ", 9) == 0 &&
+          sp > m->buf + 8) {
+        unsigned int rest = m->len - (sp + 1 - m->buf);
+
+        *sp = '\0';
+        m->search_count += imap_count_numbers(m->buf + 8);
+        memmove(m->buf + 9, sp + 1, rest);
+        m->len = 9 + rest;
+      }
+      else
+        m->len = 0;
     }
+  }
+
+  return r;
+}
+
+/* returns mailbox for ${imap_unseen host[:port] user mailbox}, same mailbox
+ * is shared */
+struct imap_mailbox *get_imap_mailbox(const char *arg) {
+  struct imap_mailbox *m;
+  char host[128], user[128], mailbox[128];
+  char *port;
+  int n;
 
-    fclose(fp);
+  if (arg == NULL)
+    return 0;
 
-    if (reading_status) info.new_mail_count++;
+  n = sscanf(arg, "%127s %127s %127s", host, user, mailbox);
+  if (n < 2)
+    return 0;
+  if (n < 3)
+    strcpy(mailbox, "INBOX");
 
-    last_mail_mtime = buf.st_mtime;
+  port = strchr(host, ':');
+  if (port)
+    *port++ = '\0';
+  else
+    port = "143";
+
+  for (m = imap_mailboxes; m; m = m->next) {
+    if (strcmp(m->host, host) == 0 && strcmp(m->port, port) == 0 &&
+        strcmp(m->user, user) == 0 && strcmp(m->mailbox, mailbox) == 0)
+      return m;
+  }
+
+  m = (struct imap_mailbox *) calloc(1, sizeof(struct imap_mailbox));
+  m->host = strdup(host);
+  m->port = strdup(port);
+  m->user = strdup(user);
+  m->mailbox = strdup(mailbox);
+  m->fd = -1;
+  m->backoff = 1;
+  m->next = imap_mailboxes;
+  imap_mailboxes = m;
+
+  return m;
+}
+
+static void clear_imap_mailboxes() {
+  while (imap_mailboxes) {
+    struct imap_mailbox *m = imap_mailboxes;
+    imap_mailboxes = m->next;
+
+    imap_disconnect(m);
+    free(m->host);
+    free(m->port);
+    free(m->user);
+    free(m->mailbox);
+    free(m);
+  }
+}
+
+static void update_imap_mailbox(struct imap_mailbox *m) {
+  double now = get_time();
+
+  switch (m->state) {
+  case IMAP_DISCONNECTED:
+    if (now >= m->retry_time)
+      imap_connect(m);
+    break;
+
+  case IMAP_IDLE:
+    /* servers may drop IDLE after 30 minutes */
+    if (now - m->state_time > 25*60)
+      imap_send(m, IMAP_DONE, "DONE");
+    break;
+
+  case IMAP_POLL:
+    if (now - m->state_time > 60)
+      imap_search(m);
+    break;
+
+  default:
+    /* server doesn't answer */
+    if (now - m->state_time > 30)
+      imap_fail(m, "timeout");
+    break;
   }
 }
 
+void update_mail_count() {
+  struct mail_spool *m;
+  struct imap_mailbox *i;
+
+  for (m = mail_spools; m; m = m->next)
+    update_mail_spool(m);
 
+  for (i = imap_mailboxes; i; i = i->next)
+    update_imap_mailbox(i);
+}
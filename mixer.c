@@ -16,6 +16,12 @@
 static int mixer_fd;
 static const char *devs[] = SOUND_DEVICE_NAMES;
 
+#define MIXER_DEVS (sizeof(devs)/sizeof(const char *))
+
+/* channels that objects use are read once per update */
+static char mixer_used[MIXER_DEVS];
+static int mixer_values[MIXER_DEVS];
+
 int mixer_init(const char *name) {
   unsigned int i;
 
@@ -30,8 +36,9 @@ int mixer_init(const char *name) {
     }
   }
 
-  for(i=0; i<sizeof(devs)/sizeof(const char *); i++) {
+  for(i=0; i<MIXER_DEVS; i++) {
     if(strcasecmp(devs[i], name) == 0) {
+      mixer_used[i] = 1;
       return i;
     }
   }
@@ -39,7 +46,12 @@ int mixer_init(const char *name) {
   return -1;
 }
 
-static int mixer_get(int i) {
+/* forgets channels of old text objects */
+void clear_mixer() {
+  memset(mixer_used, 0, sizeof(mixer_used));
+}
+
+static int mixer_read(int i) {
   static char rep = 0;
   int val = -1;
 
@@ -54,6 +66,23 @@ static int mixer_get(int i) {
   return val;
 }
 
+void update_mixer() {
+  unsigned int i;
+
+  for(i=0; i<MIXER_DEVS; i++) {
+    if(mixer_used[i])
+      mixer_values[i] = mixer_read(i);
+  }
+
+  info.mask |= (1 << INFO_MIXER);
+}
+
+static int mixer_get(int i) {
+  if(i < 0 || (unsigned int) i >= MIXER_DEVS)
+    return 0;
+  return mixer_values[i];
+}
+
 int mixer_get_avg(int i) {
   int v = mixer_get(i);
   return ((v >> 8) + (v & 0xFF)) / 2;
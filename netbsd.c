@@ -301,10 +301,6 @@ void update_cpu_usage()
 	
 }
 
-double get_i2c_info(int fd, int div) {
-    return -1;
-}
-
 void update_load_average() {
     double v[3];
     getloadavg(v, 3);
@@ -321,9 +317,22 @@ double get_acpi_temperature(int fd) {
 void get_battery_stuff(char *buf, unsigned int n, const char *bat) {
 }
 
-int open_i2c_sensor(const char *dev, const char *type, int n, int *div)
+struct hwmon_sensor *get_hwmon_sensor(const char *chip, const char *label)
+{
+    return 0;
+}
+
+struct hwmon_sensor *get_i2c_sensor(const char *dev, const char *type, int n)
+{
+    return 0;
+}
+
+void clear_hwmon()
+{
+}
+
+void update_hwmon()
 {
-    return -1;
 }
 
 int open_acpi_temperature(const char *name) {
@@ -339,3 +348,147 @@ char* get_acpi_fan() {
     return "N/A";
 }
 
+void update_top() {
+}
+
+int process_events;
+
+struct pcount *get_pcount(const char *name) {
+    return 0;
+}
+
+void clear_pcounts() {
+}
+
+void update_pcounts() {
+}
+
+struct watched_proc *get_watched_proc(const char *spec, int want) {
+    return 0;
+}
+
+void clear_watched_procs() {
+}
+
+void update_watched_procs() {
+}
+
+char *cgroup_root;
+
+struct cgroup_stat *get_cgroup_stat(const char *path, const char *dev,
+    int want) {
+    return 0;
+}
+
+struct cgroup_top *get_cgroup_top(const char *parent) {
+    return 0;
+}
+
+void clear_cgroups() {
+}
+
+void update_cgroups() {
+}
+
+struct psi_stat *get_psi(const char *resource, int full) {
+    return 0;
+}
+
+void add_psi_trigger(const char *arg) {
+}
+
+void clear_psi() {
+}
+
+void update_psi() {
+}
+
+int get_meminfo_key(const char *name) {
+    return -1;
+}
+
+int meminfo_is_count(int key) {
+    return 0;
+}
+
+struct vmstat_counter *get_vmstat(const char *name) {
+    return 0;
+}
+
+void clear_vmstat() {
+}
+
+void update_vmstat() {
+}
+
+void update_stat_counters() {
+}
+
+void update_irqs() {
+}
+
+void update_schedstat() {
+}
+
+void update_freq() {
+}
+
+struct cstate *get_cstate(const char *name) {
+    return 0;
+}
+
+void clear_cstates() {
+}
+
+void update_cstates() {
+}
+
+struct thermal_dev *get_thermal_zone(const char *name) {
+    return 0;
+}
+
+struct thermal_dev *get_cooling_device(const char *name) {
+    return 0;
+}
+
+void use_all_thermal_zones() {
+}
+
+void clear_thermal() {
+}
+
+void update_thermal() {
+}
+
+struct power_supply *get_power_supply(const char *name) {
+    return 0;
+}
+
+void use_all_power_supplies() {
+}
+
+int power_supply_time(struct power_supply *s) {
+    return -1;
+}
+
+void clear_power_supplies() {
+}
+
+void update_power_supplies() {
+}
+
+char *powercap_dir;
+
+void clear_rapl() {
+}
+
+void update_rapl() {
+}
+
+char* get_adt746x_cpu() {
+    return "";
+}
+
+char* get_adt746x_fan() {
+    return "";
+}
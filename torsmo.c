@@ -15,6 +15,7 @@
 #include <errno.h>
 #include <string.h>
 #include <limits.h>
+#include <fnmatch.h>
 #if HAVE_DIRENT_H
 #include <dirent.h>
 #endif
@@ -77,6 +78,12 @@ int no_buffers;
 /* pad percentages to decimals? */
 static int pad_percents = 0;
 
+/* row format of fs_all */
+static char *fs_all_format;
+
+/* shown after file system values that couldn't be updated */
+static char *fs_stale_marker;
+
 /* Text that is shown */
 static char original_text[] =
 "$nodename - $sysname $kernel on $machine\n"
@@ -277,39 +284,243 @@ static void human_readable(long long a, char *buf) {
     snprintf(buf, 255, "%Ld", a);
 }
 
+/* appends fs_stale_marker if fs didn't answer in fs_timeout */
+static void mark_stale_fs(char *p, unsigned int n, struct fs_stat *fs) {
+  if (fs != NULL && fs->stale) {
+    unsigned int l = strlen(p);
+    snprintf(p + l, n - l, "%s", fs_stale_marker);
+  }
+}
+
+/* file systems that aren't on a device but have space anyway */
+static const char *fs_all_devless[] = {
+  "nfs*", "cifs", "smb*", "fuse*", "9p", "ceph", "glusterfs", "afs", "zfs",
+  NULL
+};
+
+/* proc, sysfs, cgroup, tmpfs and such, source of these isn't a device */
+static int is_pseudo_fs(const struct fs_mount *m) {
+  const char **t;
+
+  if (m->dev[0] == '/')
+    return 0;
+
+  for (t = fs_all_devless; *t; t++)
+    if (fnmatch(*t, m->type, 0) == 0)
+      return 0;
+
+  return 1;
+}
+
+/* fs_all filter is comma separated list of file system types or mount point
+ * globs (starting with /), ! in front of one excludes. Pseudo file systems
+ * are only included when their type is named. */
+static int fs_all_match(const char *filter, const struct fs_mount *m) {
+  int included = 0, includes = 0, named = 0;
+
+  /* automount points would be triggered, mounted ones are listed anyway */
+  if (strcmp(m->type, "autofs") == 0)
+    return 0;
+
+  while (*filter) {
+    char buf[256];
+    const char *t = buf;
+    unsigned int len = strcspn(filter, ",");
+    int neg, hit;
+
+    if (len > 255) len = 255;
+    strncpy(buf, filter, len);
+    buf[len] = '\0';
+    filter += len;
+    if (*filter == ',') filter++;
+
+    neg = (*t == '!');
+    if (neg) t++;
+
+    if (*t == '/')
+      hit = fnmatch(t, m->dir, 0) == 0;
+    else
+      hit = fnmatch(t, m->type, 0) == 0;
+
+    if (neg) {
+      if (hit) return 0;
+    }
+    else {
+      includes = 1;
+      if (hit) included = 1;
+      if (strcmp(t, m->type) == 0) named = 1;
+    }
+  }
+
+  if (!named && is_pseudo_fs(m))
+    return 0;
+
+  return includes ? included : 1;
+}
+
+/* formats one fs_all row:
+ * %m mount point, %d device, %t type, %s size, %u used, %f free,
+ * %p used percentage, %i used inodes percentage */
+static void print_fs_row(char *p, unsigned int n, const char *f,
+    struct fs_mount *m, struct fs_stat *fs) {
+
+  while (*f && n > 1) {
+    char buf[256];
+    unsigned int len;
+
+    if (*f != '%' || f[1] == '\0') {
+      *p++ = *f++;
+      n--;
+      continue;
+    }
+
+    f++;
+    switch (*f) {
+    case 'm':
+      snprintf(buf, 256, "%s", m->dir);
+      break;
+    case 'd':
+      snprintf(buf, 256, "%s", m->dev);
+      break;
+    case 't':
+      snprintf(buf, 256, "%s", m->type);
+      break;
+    case 's':
+      human_readable(fs->size, buf);
+      break;
+    case 'u':
+      human_readable(fs->size - fs->avail, buf);
+      break;
+    case 'f':
+      human_readable(fs->avail, buf);
+      break;
+    case 'p':
+      snprintf(buf, 256, "%*d", pad_percents, fs->size ?
+          100 - (int) ((fs->avail*100) / fs->size) : 0);
+      break;
+    case 'i':
+      snprintf(buf, 256, "%*d", pad_percents, fs->files ?
+          100 - (int) ((fs->ffree*100) / fs->files) : 0);
+      break;
+    default:
+      snprintf(buf, 256, "%c", *f);
+      break;
+    }
+    f++;
+
+    len = strlen(buf);
+    if (len >= n) len = n-1;
+    memcpy(p, buf, len);
+    p += len;
+    n -= len;
+  }
+
+  *p = '\0';
+}
+
+static void print_fs_all(char *p, unsigned int n, const char *filter,
+    const char *format) {
+  struct fs_mount *mounts;
+  unsigned int i, count, rows = 0;
+
+  *p = '\0';
+  count = get_fs_mounts(&mounts);
+
+  for (i=0; i<count && n > 2; i++) {
+    struct fs_stat *fs;
+    unsigned int len;
+
+    if (!fs_all_match(filter, &mounts[i]))
+      continue;
+
+    fs = get_fs_mount_stat(&mounts[i]);
+    /* not read yet */
+    if (fs == NULL || (fs->stale && fs->size == 0))
+      continue;
+    /* rest of the things that have no space */
+    if (fs->size == 0) {
+      drop_fs_mount_stat(&mounts[i]);
+      continue;
+    }
+
+    if (rows++) {
+      *p++ = '\n';
+      n--;
+    }
+
+    print_fs_row(p, n, format, &mounts[i], fs);
+    mark_stale_fs(p, n, fs);
+    len = strlen(p);
+    p += len;
+    n -= len;
+  }
+
+  *p = '\0';
+}
+
 /* text handling */
 
 enum text_object_type {
+  OBJ_ac_online,
   OBJ_acpiacadapter,
   OBJ_adt746xcpu,
   OBJ_adt746xfan,
   OBJ_acpifan,
   OBJ_acpitemp,
   OBJ_battery,
+  OBJ_battery_time,
+  OBJ_battery_total_percent,
   OBJ_buffers,
   OBJ_cached,
+  OBJ_cgroup_cpu,
+  OBJ_cgroup_io_read,
+  OBJ_cgroup_io_write,
+  OBJ_cgroup_mem,
+  OBJ_cgroup_mem_max,
+  OBJ_cgroup_pids,
+  OBJ_cgroup_top,
+  OBJ_cgroup_top_mem,
   OBJ_color,
+  OBJ_cooling,
   OBJ_cpu,
   OBJ_cpubar,
+  OBJ_cstate,
+  OBJ_cstate_usage,
+  OBJ_ctxt_rate,
   OBJ_downspeed,
   OBJ_downspeedf,
+  OBJ_energy_total,
   OBJ_exec,
   OBJ_execi,
+  OBJ_fork_rate,
   OBJ_freq,
+  OBJ_freq_avg,
+  OBJ_freq_max,
+  OBJ_freq_min,
+  OBJ_fs_all,
   OBJ_fs_bar,
   OBJ_fs_bar_free,
   OBJ_fs_free,
   OBJ_fs_free_perc,
+  OBJ_fs_inodes,
+  OBJ_fs_inodes_free,
+  OBJ_fs_inodes_used_perc,
   OBJ_fs_size,
   OBJ_fs_used,
   OBJ_fs_used_perc,
   OBJ_hr,
+  OBJ_hwmon,
   OBJ_i2c,
+  OBJ_imap_unseen,
+  OBJ_intr_rate,
+  OBJ_irq_cpu,
+  OBJ_irq_top,
   OBJ_kernel,
   OBJ_loadavg,
   OBJ_machine,
   OBJ_mails,
   OBJ_mem,
+  OBJ_meminfo,
   OBJ_membar,
   OBJ_memmax,
   OBJ_memperc,
@@ -324,9 +535,22 @@ enum text_object_type {
 #ifdef NVCTRL
   OBJ_nvctrl,
 #endif
+  OBJ_pcount,
+  OBJ_power_dram,
+  OBJ_power_draw_w,
+  OBJ_power_pkg,
   OBJ_pre_exec,
+  OBJ_proc_cpu,
+  OBJ_proc_fds,
+  OBJ_proc_io_read,
+  OBJ_proc_rss,
+  OBJ_proc_threads,
   OBJ_processes,
+  OBJ_procs_blocked,
+  OBJ_psi,
   OBJ_running_processes,
+  OBJ_runq_latency,
+  OBJ_runq_latency_max,
   OBJ_shadecolor,
   OBJ_outlinecolor,
   OBJ_stippled_hr,
@@ -338,15 +562,22 @@ enum text_object_type {
   OBJ_temp1, /* i2c is used instead in these */
   OBJ_temp2,
   OBJ_text,
+  OBJ_thermal,
+  OBJ_thermal_max,
+  OBJ_throttle_count,
   OBJ_time,
   OBJ_utime,
   OBJ_totaldown,
+  OBJ_top,
+  OBJ_top_mem,
   OBJ_totalup,
   OBJ_updates,
   OBJ_upspeed,
   OBJ_upspeedf,
   OBJ_uptime,
   OBJ_uptime_short,
+  OBJ_vmstat,
+  OBJ_vmstat_rate,
 #ifdef SETI
   OBJ_seti_prog,
   OBJ_seti_progbar,
@@ -362,6 +593,12 @@ struct text_object {
     long l;  /* some other integer */
     struct net_stat *net;
     struct fs_stat *fs;
+    struct mail_spool *mail;
+    struct vmstat_counter *vmstat;
+    struct imap_mailbox *imap;
+    struct pcount *pcount;
+    struct watched_proc *proc;
+    struct cgroup_stat *cgroup;
     unsigned char loadavg[3];
 
     struct {
@@ -374,10 +611,14 @@ struct text_object {
       int w, h;
     } mixerbar; /* 3 */
 
+    struct hwmon_sensor *sensor;
+    struct thermal_dev *thermal;
+    struct power_supply *supply;
+
     struct {
-      int fd;
-      int arg;
-    } i2c; /* 2 */
+      struct thermal_dev *dev;
+      int max;
+    } cooling; /* 2 */
 
     struct {
       double last_update;
@@ -390,6 +631,32 @@ struct text_object {
       int a, b;
     } pair; /* 2 */
 
+    struct {
+      char *filter;
+      char *format;
+    } fsall; /* 2 */
+
+    struct {
+      int type;
+      int num;
+    } top; /* 2 */
+
+    struct {
+      struct cgroup_top *t;
+      int type;
+      int num;
+    } cgtop; /* 3 */
+
+    struct {
+      struct psi_stat *p;
+      int field;
+    } psi; /* 2 */
+
+    struct {
+      struct cstate *c;
+      int cpu; /* all if -1 */
+    } cstate; /* 2 */
+
 #ifdef NVCTRL
     struct {
       unsigned int arg;
@@ -417,14 +684,6 @@ static void free_text_objects() {
 
   for (i=0; i<text_object_count; i++) {
     switch (text_objects[i].type) {
-    case OBJ_acpitemp:
-      close(text_objects[i].data.i);
-      break;
-
-    case OBJ_i2c:
-      close(text_objects[i].data.i2c.fd);
-      break;
-
     case OBJ_time:
     case OBJ_utime:
     case OBJ_text:
@@ -438,6 +697,11 @@ static void free_text_objects() {
       free(text_objects[i].data.execi.cmd);
       free(text_objects[i].data.execi.buffer);
       break;
+
+    case OBJ_fs_all:
+      free(text_objects[i].data.fsall.filter);
+      free(text_objects[i].data.fsall.format);
+      break;
     }
   }
 
@@ -460,11 +724,216 @@ void scan_mixer_bar(const char *arg, int *a, int *w, int *h) {
   }
 }
 
+enum {
+  TOP_NAME,
+  TOP_PID,
+  TOP_CPU,
+  TOP_MEM,
+  TOP_IRQ,
+  TOP_RATE,
+};
+
+/* ${top name|pid|cpu|mem N}, N is from 1 to MAX_TOP */
+static void scan_top(const char *arg, int *type, int *num) {
+  char buf[8];
+  int n = 0;
+
+  *type = TOP_NAME;
+  *num = 0;
+
+  if (arg == NULL || sscanf(arg, "%7s %d", buf, &n) != 2 || n < 1 ||
+      n > MAX_TOP) {
+    ERR("${top name|pid|cpu|mem N}, N is from 1 to %d", MAX_TOP);
+    return;
+  }
+
+  if (strcmp(buf, "pid") == 0)
+    *type = TOP_PID;
+  else if (strcmp(buf, "cpu") == 0)
+    *type = TOP_CPU;
+  else if (strcmp(buf, "mem") == 0)
+    *type = TOP_MEM;
+  else if (strcmp(buf, "name") != 0)
+    ERR("top: unknown type '%s'", buf);
+
+  *num = n;
+}
+
+static void print_top(char *p, int n, struct top_proc *top, int type) {
+  /* not enough processes */
+  if (top->pid == 0) {
+    p[0] = '\0';
+    return;
+  }
+
+  switch (type) {
+  case TOP_NAME:
+    snprintf(p, n, "%s", top->name);
+    break;
+  case TOP_PID:
+    snprintf(p, n, "%d", top->pid);
+    break;
+  case TOP_CPU:
+    snprintf(p, n, "%.2f", top->cpu);
+    break;
+  case TOP_MEM:
+    snprintf(p, n, "%.2f", top->mem);
+    break;
+  }
+}
+
+static void print_cgroup_top(char *p, int n, struct cgroup_top_entry *top,
+    int type) {
+  /* not enough cgroups */
+  if (top->name[0] == '\0')
+    return;
+
+  switch (type) {
+  case TOP_CPU:
+    snprintf(p, n, "%.1f", top->cpu);
+    break;
+  case TOP_MEM:
+    human_readable(top->mem, p);
+    break;
+  default:
+    snprintf(p, n, "%s", top->name);
+    break;
+  }
+}
+
+static void print_sensor(char *p, int n, struct hwmon_sensor *s) {
+  double r = s ? s->value : 0;
+
+  if (r >= 100.0 || r == 0)
+    snprintf(p, n, "%d", (int) r);
+  else
+    snprintf(p, n, "%.1f", r);
+}
+
+enum {
+  FREQ_MIN,
+  FREQ_MAX,
+  FREQ_AVG,
+};
+
+/* cpus that are offline or unknown are left out */
+static void print_freq(char *p, int n, struct cpu_cores *c, int type) {
+  float min = 0, max = 0, sum = 0;
+  unsigned int i, count = 0;
+
+  for (i=0; i<c->count; i++) {
+    if (c->freq[i] <= 0)
+      continue;
+    if (count == 0 || c->freq[i] < min)
+      min = c->freq[i];
+    if (c->freq[i] > max)
+      max = c->freq[i];
+    sum += c->freq[i];
+    count++;
+  }
+
+  if (count == 0) {
+    p[0] = '\0';
+    return;
+  }
+
+  snprintf(p, n, "%.0f", type == FREQ_MIN ? min :
+      type == FREQ_MAX ? max : sum / count);
+}
+
+/* ${cstate name (cpu)} */
+static void scan_cstate(const char *arg, struct cstate **c, int *cpu) {
+  char name[16];
+  int r;
+
+  *c = 0;
+  *cpu = -1;
+
+  if (arg == NULL || (r = sscanf(arg, "%15s %d", name, cpu)) < 1) {
+    ERR("${cstate name (cpu)}, name is like C6");
+    return;
+  }
+
+  *c = get_cstate(name);
+}
+
+/* ${irq_top (name|irq|rate) N} */
+static void scan_irq_top(const char *arg, int *type, int *num) {
+  char buf[8];
+  int n = 0;
+
+  *type = TOP_NAME;
+  *num = 0;
+
+  if (arg && sscanf(arg, "%d", &n) == 1)
+    ;
+  else if (arg == NULL || sscanf(arg, "%7s %d", buf, &n) != 2)
+    n = 0;
+  else if (strcmp(buf, "irq") == 0)
+    *type = TOP_IRQ;
+  else if (strcmp(buf, "rate") == 0)
+    *type = TOP_RATE;
+  else if (strcmp(buf, "name") != 0)
+    ERR("irq_top: unknown type '%s'", buf);
+
+  if (n < 1 || n > MAX_IRQ_TOP) {
+    ERR("${irq_top (name|irq|rate) N}, N is from 1 to %d", MAX_IRQ_TOP);
+    return;
+  }
+
+  *num = n;
+}
+
+static void print_irq_top(char *p, int n, struct irq_top *top, int type) {
+  /* not enough interrupts */
+  if (top->rate == 0) {
+    p[0] = '\0';
+    return;
+  }
+
+  switch (type) {
+  case TOP_NAME:
+    snprintf(p, n, "%s", top->name);
+    break;
+  case TOP_IRQ:
+    snprintf(p, n, "%s", top->irq);
+    break;
+  case TOP_RATE:
+    snprintf(p, n, "%.0f", top->rate);
+    break;
+  }
+}
+
+/* ${cgroup_* path (device)} */
+static struct cgroup_stat *scan_cgroup(const char *arg, int file) {
+  char path[256], dev[32];
+  int n;
+
+  if (arg == NULL || (n = sscanf(arg, "%255s %31s", path, dev)) < 1) {
+    ERR("cgroup_* needs cgroup path");
+    return 0;
+  }
+
+  return get_cgroup_stat(path, n == 2 ? dev : 0, 1 << file);
+}
+
+
+/* ${proc_* pidfile|name} */
+static struct watched_proc *scan_proc(const char *arg, int want) {
+  if (arg == NULL) {
+    ERR("proc_* needs pidfile or process name");
+    return 0;
+  }
+
+  while (isspace(*arg)) arg++;
+  return get_watched_proc(arg, want);
+}
+
 /* construct_text_object() creates a new text_object */
 static void construct_text_object(const char *s, const char *arg) {
   struct text_object *obj = new_text_object();
 
-#define OBJ(a, n) if (strcmp(s, #a) == 0) { obj->type = OBJ_##a; need_mask |= (1 << n); {
+#define OBJ(a, n) if (strcmp(s, #a) == 0) { obj->type = OBJ_##a; need_mask |= (1U << n); {
 #define END ; } } else
 
   if (s[0] == '#') {
@@ -472,41 +941,135 @@ static void construct_text_object(const char *s, const char *arg) {
     obj->data.l = get_x11_color(s);
   }
   else
-  OBJ(acpitemp, 0)
+  OBJ(acpitemp, INFO_THERMAL)
     obj->data.i = open_acpi_temperature(arg);
   END
-  OBJ(acpiacadapter, 0)
+  OBJ(acpiacadapter, INFO_ACPI_AC)
+  END
+  OBJ(adt746xcpu, INFO_ADT746X_CPU)
+  END
+  OBJ(adt746xfan, INFO_ADT746X_FAN)
+  END
+  OBJ(freq, INFO_FREQ)
+    obj->data.i = arg ? atoi(arg) : 0;
+  END
+  OBJ(freq_avg, INFO_FREQ)
+  END
+  OBJ(freq_max, INFO_FREQ)
+  END
+  OBJ(freq_min, INFO_FREQ)
   END
-  OBJ(freq, 0)
+  OBJ(acpifan, INFO_ACPI_FAN)
   END
-  OBJ(acpifan, 0)
+  OBJ(ac_online, INFO_POWER)
+    use_all_power_supplies();
   END
-  OBJ(battery, 0)
+  OBJ(battery, INFO_POWER)
     char bat[64];
     if (arg)
       sscanf(arg, "%63s", bat);
     else
       strcpy(bat, "BAT0");
     obj->data.s = strdup(bat);
+    (void) get_power_supply(bat);
+  END
+  OBJ(battery_time, INFO_POWER)
+    /* all batteries if NULL */
+    obj->data.supply = 0;
+    if (arg)
+      obj->data.supply = get_power_supply(arg);
+    else
+      use_all_power_supplies();
+  END
+  OBJ(battery_total_percent, INFO_POWER)
+    use_all_power_supplies();
   END
   OBJ(buffers, INFO_BUFFERS)
   END
   OBJ(cached, INFO_BUFFERS)
   END
+  OBJ(cgroup_cpu, INFO_CGROUP)
+    obj->data.cgroup = scan_cgroup(arg, CGROUP_CPU);
+  END
+  OBJ(cgroup_io_read, INFO_CGROUP)
+    obj->data.cgroup = scan_cgroup(arg, CGROUP_IO);
+  END
+  OBJ(cgroup_io_write, INFO_CGROUP)
+    obj->data.cgroup = scan_cgroup(arg, CGROUP_IO);
+  END
+  OBJ(cgroup_mem, INFO_CGROUP)
+    obj->data.cgroup = scan_cgroup(arg, CGROUP_MEM);
+  END
+  OBJ(cgroup_mem_max, INFO_CGROUP)
+    obj->data.cgroup = scan_cgroup(arg, CGROUP_MEM_MAX);
+  END
+  OBJ(cgroup_pids, INFO_CGROUP)
+    obj->data.cgroup = scan_cgroup(arg, CGROUP_PIDS);
+  END
+  OBJ(cgroup_top, INFO_CGROUP)
+    char parent[256];
+
+    /* ${cgroup_top name|cpu|mem N (parent)} */
+    parent[0] = '\0';
+    if (arg)
+      sscanf(arg, "%*s %*d %255s", parent);
+
+    scan_top(arg, &obj->data.cgtop.type, &obj->data.cgtop.num);
+    obj->data.cgtop.t = get_cgroup_top(parent);
+  END
+  OBJ(cgroup_top_mem, INFO_CGROUP)
+    char parent[256];
+
+    parent[0] = '\0';
+    if (arg)
+      sscanf(arg, "%*s %*d %255s", parent);
+
+    scan_top(arg, &obj->data.cgtop.type, &obj->data.cgtop.num);
+    obj->data.cgtop.t = get_cgroup_top(parent);
+  END
   OBJ(cpu, INFO_CPU)
   END
   OBJ(cpubar, INFO_CPU)
     (void) scan_bar(arg, &obj->data.pair.a, &obj->data.pair.b);
   END
+  OBJ(cstate, INFO_CSTATE)
+    scan_cstate(arg, &obj->data.cstate.c, &obj->data.cstate.cpu);
+  END
+  OBJ(cstate_usage, INFO_CSTATE)
+    scan_cstate(arg, &obj->data.cstate.c, &obj->data.cstate.cpu);
+  END
+  OBJ(ctxt_rate, INFO_STAT)
+  END
+  OBJ(fork_rate, INFO_STAT)
+  END
+  OBJ(intr_rate, INFO_STAT)
+  END
   OBJ(color, 0)
     obj->data.l = arg ? get_x11_color(arg) : default_fg_color;
   END
+  OBJ(cooling, INFO_THERMAL)
+    char name[64], what[8];
+
+    name[0] = what[0] = '\0';
+    if (arg)
+      sscanf(arg, "%63s %7s", name, what);
+    /* ${cooling max} is max state of first device */
+    if (what[0] == '\0' && strcmp(name, "max") == 0) {
+      strcpy(what, name);
+      name[0] = '\0';
+    }
+
+    obj->data.cooling.dev = get_cooling_device(name[0] ? name : NULL);
+    obj->data.cooling.max = strcmp(what, "max") == 0;
+  END
   OBJ(downspeed, INFO_NET)
     obj->data.net = get_net_stat(arg);
   END
   OBJ(downspeedf, INFO_NET)
     obj->data.net = get_net_stat(arg);
   END
+  OBJ(energy_total, INFO_RAPL)
+  END
 #ifdef HAVE_POPEN
   OBJ(exec, 0)
     obj->data.s = strdup(arg ? arg : "");
@@ -529,7 +1092,7 @@ static void construct_text_object(const char *s, const char *arg) {
   OBJ(pre_exec, 0)
     obj->type = OBJ_text;
     if (arg) {
-      FILE *fp = popen(arg, "r");
+      FILE *fp = exec_popen(arg);
       unsigned int n;
       char buf[2048];
 
@@ -546,6 +1109,19 @@ static void construct_text_object(const char *s, const char *arg) {
       obj->data.s = strdup("");
   END
 #endif
+  OBJ(fs_all, INFO_FS)
+    char buf[64];
+    int n = 0;
+
+    /* ${fs_all (filter) (row format)} */
+    if (arg && sscanf(arg, "%63s %n", buf, &n) >= 1) {
+      obj->data.fsall.filter = strdup(buf);
+      if (arg[n] != '\0')
+        obj->data.fsall.format = strdup(arg + n);
+    }
+    else
+      obj->data.fsall.filter = strdup("*");
+  END
   OBJ(fs_bar, INFO_FS)
     obj->data.fsbar.h = 4;
     arg = scan_bar(arg, &obj->data.fsbar.w, &obj->data.fsbar.h);
@@ -580,6 +1156,18 @@ static void construct_text_object(const char *s, const char *arg) {
     if (!arg) arg = "/";
     obj->data.fs = prepare_fs_stat(arg);
   END
+  OBJ(fs_inodes, INFO_FS)
+    if (!arg) arg = "/";
+    obj->data.fs = prepare_fs_stat(arg);
+  END
+  OBJ(fs_inodes_free, INFO_FS)
+    if (!arg) arg = "/";
+    obj->data.fs = prepare_fs_stat(arg);
+  END
+  OBJ(fs_inodes_used_perc, INFO_FS)
+    if (!arg) arg = "/";
+    obj->data.fs = prepare_fs_stat(arg);
+  END
   OBJ(fs_size, INFO_FS)
     if (!arg) arg = "/";
     obj->data.fs = prepare_fs_stat(arg);
@@ -591,6 +1179,24 @@ static void construct_text_object(const char *s, const char *arg) {
   OBJ(hr, 0)
     obj->data.i = arg ? atoi(arg) : 1;
   END
+  OBJ(hwmon, INFO_I2C)
+    char chip[32], label[48];
+    const char *l;
+
+    /* ${hwmon coretemp "Package id 0"} */
+    if (arg == NULL || sscanf(arg, "%31s", chip) != 1) {
+      ERR("${hwmon chip label}");
+      return;
+    }
+    l = arg + strcspn(arg, " \t");
+    l += strspn(l, " \t");
+    if (*l == '"')
+      l++;
+    snprintf(label, 48, "%s", l);
+    label[strcspn(label, "\"")] = '\0';
+
+    obj->data.sensor = get_hwmon_sensor(chip, label);
+  END
   OBJ(i2c, INFO_I2C)
     char buf1[64], buf2[64];
     int n;
@@ -605,11 +1211,12 @@ static void construct_text_object(const char *s, const char *arg) {
     if(sscanf(arg, "%63s %63s %d", buf1, buf2, &n) != 3) {
       /* if scanf couldn't read three values, read type and num and use
        * default device */
+      n = 0;
       sscanf(arg, "%63s %d", buf2, &n);
-      obj->data.i2c.fd = open_i2c_sensor(0, buf2, n, &obj->data.i2c.arg);
+      obj->data.sensor = get_i2c_sensor(0, buf2, n);
     }
     else {
-      obj->data.i2c.fd = open_i2c_sensor(buf1, buf2, n, &obj->data.i2c.arg);
+      obj->data.sensor = get_i2c_sensor(buf1, buf2, n);
     }
   END
   OBJ(loadavg, INFO_LOADAVG)
@@ -627,14 +1234,31 @@ static void construct_text_object(const char *s, const char *arg) {
     obj->data.loadavg[1] = (r >= 2) ? (unsigned char) b : 0;
     obj->data.loadavg[2] = (r >= 3) ? (unsigned char) c : 0;
   END
+  OBJ(irq_cpu, INFO_IRQ)
+    obj->data.i = arg ? atoi(arg) : 0;
+  END
+  OBJ(irq_top, INFO_IRQ)
+    scan_irq_top(arg, &obj->data.top.type, &obj->data.top.num);
+  END
+  OBJ(imap_unseen, INFO_MAIL)
+    obj->data.imap = get_imap_mailbox(arg);
+    if (obj->data.imap == NULL)
+      ERR("${imap_unseen host[:port] user (mailbox)}");
+  END
   OBJ(kernel, 0)
   END
   OBJ(machine, 0)
   END
   OBJ(mails, INFO_MAIL)
+    obj->data.mail = get_mail_spool(arg ? arg : current_mail_spool);
   END
   OBJ(mem, INFO_MEM)
   END
+  OBJ(meminfo, INFO_MEM)
+    obj->data.i = arg ? get_meminfo_key(arg) : -1;
+    if (obj->data.i < 0)
+      ERR("meminfo: unknown field '%s'", arg ? arg : "");
+  END
   OBJ(memmax, INFO_MEM)
   END
   OBJ(memperc, INFO_MEM)
@@ -664,6 +1288,7 @@ static void construct_text_object(const char *s, const char *arg) {
         &obj->data.mixerbar.h);
   END
   OBJ(new_mails, INFO_MAIL)
+    obj->data.mail = get_mail_spool(arg ? arg : current_mail_spool);
   END
   OBJ(nodename, 0)
   END
@@ -672,10 +1297,67 @@ static void construct_text_object(const char *s, const char *arg) {
     obj->data.nvctrl.arg = init_nvctrl(arg);
   END
 #endif
+  OBJ(power_dram, INFO_RAPL)
+  END
+  OBJ(power_draw_w, INFO_POWER)
+    use_all_power_supplies();
+  END
+  OBJ(power_pkg, INFO_RAPL)
+  END
+  OBJ(pcount, INFO_PCOUNT)
+    if (arg)
+      obj->data.pcount = get_pcount(arg);
+    else
+      ERR("pcount needs process name");
+  END
+  OBJ(proc_cpu, INFO_PROC)
+    obj->data.proc = scan_proc(arg, 0);
+  END
+  OBJ(proc_fds, INFO_PROC)
+    obj->data.proc = scan_proc(arg, WATCH_FDS);
+  END
+  OBJ(proc_io_read, INFO_PROC)
+    obj->data.proc = scan_proc(arg, WATCH_IO);
+  END
+  OBJ(proc_rss, INFO_PROC)
+    obj->data.proc = scan_proc(arg, 0);
+  END
+  OBJ(proc_threads, INFO_PROC)
+    obj->data.proc = scan_proc(arg, 0);
+  END
   OBJ(processes, INFO_PROCS)
   END
+  OBJ(procs_blocked, INFO_STAT)
+  END
+  OBJ(psi, INFO_PSI)
+    char res[16], kind[8], field[8];
+    int r;
+
+    /* ${psi cpu|memory|io|irq (some|full) (avg10|avg60|avg300|total)} */
+    strcpy(kind, "some");
+    strcpy(field, "avg10");
+    r = arg ? sscanf(arg, "%15s %7s %7s", res, kind, field) : 0;
+
+    obj->data.psi.field = 0;
+    if (strcmp(field, "avg60") == 0)
+      obj->data.psi.field = 1;
+    else if (strcmp(field, "avg300") == 0)
+      obj->data.psi.field = 2;
+    else if (strcmp(field, "total") == 0)
+      obj->data.psi.field = 3;
+
+    obj->data.psi.p = r >= 1 ? get_psi(res, strcmp(kind, "full") == 0) : 0;
+    if (obj->data.psi.p == NULL)
+      ERR("${psi cpu|memory|io|irq (some|full) (avg10|avg60|avg300|total)}");
+  END
   OBJ(running_processes, INFO_RUN_PROCS)
   END
+  OBJ(runq_latency, INFO_SCHED)
+    /* all cpus if -1 */
+    obj->data.i = arg ? atoi(arg) : -1;
+  END
+  OBJ(runq_latency_max, INFO_SCHED)
+  END
   OBJ(shadecolor, 0)
     obj->data.l = arg ? get_x11_color(arg) : default_bg_color;
   END
@@ -705,11 +1387,19 @@ static void construct_text_object(const char *s, const char *arg) {
   END
   OBJ(temp1, INFO_I2C)
     obj->type = OBJ_i2c;
-    obj->data.i2c.fd = open_i2c_sensor(0, "temp", 1, &obj->data.i2c.arg);
+    obj->data.sensor = get_i2c_sensor(0, "temp", 1);
   END
   OBJ(temp2, INFO_I2C)
     obj->type = OBJ_i2c;
-    obj->data.i2c.fd = open_i2c_sensor(0, "temp", 2, &obj->data.i2c.arg);
+    obj->data.sensor = get_i2c_sensor(0, "temp", 2);
+  END
+  OBJ(thermal, INFO_THERMAL)
+    obj->data.thermal = get_thermal_zone(arg);
+  END
+  OBJ(thermal_max, INFO_THERMAL)
+    use_all_thermal_zones();
+  END
+  OBJ(throttle_count, INFO_FREQ)
   END
   OBJ(time, 0)
     obj->data.s = strdup(arg ? arg : "%F %T");
@@ -720,6 +1410,12 @@ static void construct_text_object(const char *s, const char *arg) {
   OBJ(totaldown, INFO_NET)
     obj->data.net = get_net_stat(arg);
   END
+  OBJ(top, INFO_TOP)
+    scan_top(arg, &obj->data.top.type, &obj->data.top.num);
+  END
+  OBJ(top_mem, INFO_TOP)
+    scan_top(arg, &obj->data.top.type, &obj->data.top.num);
+  END
   OBJ(totalup, INFO_NET)
     obj->data.net = get_net_stat(arg);
   END
@@ -735,6 +1431,16 @@ static void construct_text_object(const char *s, const char *arg) {
   END
   OBJ(uptime, INFO_UPTIME)
   END
+  OBJ(vmstat, INFO_VMSTAT)
+    obj->data.vmstat = arg ? get_vmstat(arg) : 0;
+    if (arg == NULL)
+      ERR("vmstat needs a counter name");
+  END
+  OBJ(vmstat_rate, INFO_VMSTAT)
+    obj->data.vmstat = arg ? get_vmstat(arg) : 0;
+    if (arg == NULL)
+      ERR("vmstat_rate needs a counter name");
+  END
 #ifdef SETI
   OBJ(seti_prog, INFO_SETI)
   END
@@ -886,28 +1592,53 @@ static void generate_text() {
       snprintf(p, n, "%d", (int) get_acpi_temperature(obj->data.i));
     }
     OBJ(freq) {
-      snprintf(p, n, "%s", get_freq());
+      if ((unsigned int) obj->data.i < cur->cores.count &&
+          cur->cores.freq[obj->data.i] > 0)
+        snprintf(p, n, "%.0f", cur->cores.freq[obj->data.i]);
+    }
+    OBJ(freq_avg) {
+      print_freq(p, n, &cur->cores, FREQ_AVG);
+    }
+    OBJ(freq_max) {
+      print_freq(p, n, &cur->cores, FREQ_MAX);
+    }
+    OBJ(freq_min) {
+      print_freq(p, n, &cur->cores, FREQ_MIN);
     }
     OBJ(adt746xcpu) {
-      snprintf(p, n, "%s", get_adt746x_cpu());
+      snprintf(p, n, "%s", cur->adt746x_cpu);
     }
     OBJ(adt746xfan) {
-      snprintf(p, n, "%s", get_adt746x_fan());
+      snprintf(p, n, "%s", cur->adt746x_fan);
     }
     OBJ(acpifan) {
-      snprintf(p, n, "%s", get_acpi_fan());
+      snprintf(p, n, "%s", cur->acpi_fan);
     }
     OBJ(acpiacadapter) {
-      snprintf(p, n, "%s", get_acpi_ac_adapter());
+      snprintf(p, n, "%s", cur->acpi_ac_adapter);
+    }
+    OBJ(ac_online) {
+      snprintf(p, n, "%s", cur->ac_online ? "on" : "off");
     }
     OBJ(battery) {
       get_battery_stuff(p, n, obj->data.s);
     }
+    OBJ(battery_time) {
+      int t = obj->data.supply ? power_supply_time(obj->data.supply) :
+        cur->battery_time;
+
+      if (t >= 0)
+        format_seconds(p, n, t);
+    }
+    OBJ(battery_total_percent) {
+      if (cur->battery_total_percent >= 0)
+        snprintf(p, n, "%*d", pad_percents, (int) cur->battery_total_percent);
+    }
     OBJ(buffers) {
-      human_readable(cur->buffers*1024, p);
+      human_readable((long long) cur->buffers*1024, p);
     }
     OBJ(cached) {
-      human_readable(cur->cached*1024, p);
+      human_readable((long long) cur->cached*1024, p);
     }
     OBJ(cpu) {
       snprintf(p, n, "%*d", pad_percents, (int) (cur->cpu_usage*100.0));
@@ -915,19 +1646,107 @@ static void generate_text() {
     OBJ(cpubar) {
       new_bar(p, obj->data.pair.a, obj->data.pair.b, (int) (cur->cpu_usage*255.0));
     }
+    OBJ(cstate) {
+      struct cstate *c = obj->data.cstate.c;
+      int cpu = obj->data.cstate.cpu;
+
+      if (c && cpu < 0)
+        snprintf(p, n, "%.1f", c->residency);
+      else if (c && (unsigned int) cpu < c->cpus)
+        snprintf(p, n, "%.1f", c->cpu_residency[cpu]);
+    }
+    OBJ(cstate_usage) {
+      struct cstate *c = obj->data.cstate.c;
+      int cpu = obj->data.cstate.cpu;
+
+      if (c && cpu < 0)
+        snprintf(p, n, "%.0f", c->usage);
+      else if (c && (unsigned int) cpu < c->cpus)
+        snprintf(p, n, "%.0f", c->cpu_usage[cpu]);
+    }
+    OBJ(ctxt_rate) {
+      snprintf(p, n, "%.0f", cur->ctxt_rate);
+    }
+    OBJ(fork_rate) {
+      snprintf(p, n, "%.1f", cur->fork_rate);
+    }
+    OBJ(irq_cpu) {
+      if ((unsigned int) obj->data.i < cur->irq_cpus)
+        snprintf(p, n, "%.0f", cur->irq_cpu[obj->data.i]);
+    }
+    OBJ(irq_top) {
+      if (obj->data.top.num)
+        print_irq_top(p, n, &cur->irq_top[obj->data.top.num-1],
+            obj->data.top.type);
+    }
+    OBJ(intr_rate) {
+      snprintf(p, n, "%.0f", cur->intr_rate);
+    }
+    OBJ(cgroup_cpu) {
+      if (obj->data.cgroup)
+        snprintf(p, n, "%.1f", obj->data.cgroup->cpu);
+    }
+    OBJ(cgroup_io_read) {
+      if (obj->data.cgroup)
+        snprintf(p, n, "%d", (int) (obj->data.cgroup->io_read/1024));
+    }
+    OBJ(cgroup_io_write) {
+      if (obj->data.cgroup)
+        snprintf(p, n, "%d", (int) (obj->data.cgroup->io_write/1024));
+    }
+    OBJ(cgroup_mem) {
+      if (obj->data.cgroup)
+        human_readable(obj->data.cgroup->mem, p);
+    }
+    OBJ(cgroup_mem_max) {
+      if (obj->data.cgroup && obj->data.cgroup->mem_max < 0)
+        snprintf(p, n, "max");
+      else if (obj->data.cgroup)
+        human_readable(obj->data.cgroup->mem_max, p);
+    }
+    OBJ(cgroup_pids) {
+      if (obj->data.cgroup)
+        snprintf(p, n, "%u", obj->data.cgroup->pids);
+    }
+    OBJ(cgroup_top) {
+      struct cgroup_top *t = obj->data.cgtop.t;
+
+      if (t && obj->data.cgtop.num)
+        print_cgroup_top(p, n, &t->top_cpu[obj->data.cgtop.num-1],
+            obj->data.cgtop.type);
+    }
+    OBJ(cgroup_top_mem) {
+      struct cgroup_top *t = obj->data.cgtop.t;
+
+      if (t && obj->data.cgtop.num)
+        print_cgroup_top(p, n, &t->top_mem[obj->data.cgtop.num-1],
+            obj->data.cgtop.type);
+    }
     OBJ(color) {
       new_fg(p, obj->data.l);
     }
+    OBJ(cooling) {
+      struct thermal_dev *t = obj->data.cooling.dev;
+
+      if (t && obj->data.cooling.max)
+        snprintf(p, n, "%d", t->max_state);
+      else if (t && t->valid)
+        snprintf(p, n, "%d", (int) t->value);
+    }
     OBJ(downspeed) {
       snprintf(p, n, "%d", (int) (obj->data.net->recv_speed/1024));
     }
     OBJ(downspeedf) {
       snprintf(p, n, "%.1f", obj->data.net->recv_speed/1024.0);
     }
+    OBJ(energy_total) {
+      /* in Wh */
+      snprintf(p, n, "%.2f", cur->energy_total / 3600.0);
+    }
 #ifdef HAVE_POPEN
     OBJ(exec) {
       char *p2 = p;
-      FILE *fp = popen(obj->data.s, "r");
+      FILE *fp = exec_popen(obj->data.s);
       int n2 = fread(p, 1, n, fp);
       (void) pclose(fp);
 
@@ -947,7 +1766,7 @@ static void generate_text() {
       }
       else {
         char *p2 = obj->data.execi.buffer;
-        FILE *fp = popen(obj->data.execi.cmd, "r");
+        FILE *fp = exec_popen(obj->data.execi.cmd);
         int n2 = fread(p2, 1, TEXT_BUFFER_SIZE, fp);
         (void) pclose(fp);
 
@@ -966,6 +1785,10 @@ static void generate_text() {
       }
     }
 #endif
+    OBJ(fs_all) {
+      print_fs_all(p, n, obj->data.fsall.filter,
+          obj->data.fsall.format ? obj->data.fsall.format : fs_all_format);
+    }
     OBJ(fs_bar) {
       if (obj->data.fs != NULL) {
         if (obj->data.fs->size == 0)
@@ -978,6 +1801,7 @@ static void generate_text() {
     OBJ(fs_free) {
       if (obj->data.fs != NULL)
         human_readable(obj->data.fs->avail, p);
+      mark_stale_fs(p, n, obj->data.fs);
     }
     OBJ(fs_free_perc) {
       if (obj->data.fs != NULL) {
@@ -987,14 +1811,37 @@ static void generate_text() {
         else
           snprintf(p, n, "0");
       }
+      mark_stale_fs(p, n, obj->data.fs);
+    }
+    OBJ(fs_inodes) {
+      if (obj->data.fs != NULL)
+        snprintf(p, n, "%Ld", obj->data.fs->files);
+      mark_stale_fs(p, n, obj->data.fs);
+    }
+    OBJ(fs_inodes_free) {
+      if (obj->data.fs != NULL)
+        snprintf(p, n, "%Ld", obj->data.fs->ffree);
+      mark_stale_fs(p, n, obj->data.fs);
+    }
+    OBJ(fs_inodes_used_perc) {
+      if (obj->data.fs != NULL) {
+        if (obj->data.fs->files)
+          snprintf(p, n, "%*d", pad_percents,
+              100 - (int) ((obj->data.fs->ffree*100) / obj->data.fs->files));
+        else
+          snprintf(p, n, "0");
+      }
+      mark_stale_fs(p, n, obj->data.fs);
     }
     OBJ(fs_size) {
       if (obj->data.fs != NULL)
         human_readable(obj->data.fs->size, p);
+      mark_stale_fs(p, n, obj->data.fs);
     }
     OBJ(fs_used) {
       if (obj->data.fs != NULL)
         human_readable(obj->data.fs->size - obj->data.fs->avail, p);
+      mark_stale_fs(p, n, obj->data.fs);
     }
     OBJ(fs_bar_free) {
 	  if (obj->data.fs != NULL) {
@@ -1013,6 +1860,7 @@ static void generate_text() {
       else
         snprintf(p, n, "0");
       }
+      mark_stale_fs(p, n, obj->data.fs);
     }
     OBJ(loadavg) {
       float *v = info.loadavg;
@@ -1030,14 +1878,10 @@ static void generate_text() {
       new_hr(p, obj->data.i);
     }
     OBJ(i2c) {
-      double r;
-
-      r = get_i2c_info(obj->data.i2c.fd, obj->data.i2c.arg);
-
-      if (r >= 100.0 || r == 0)
-        snprintf(p, n, "%d", (int) r);
-      else
-        snprintf(p, n, "%.1f", r);
+      print_sensor(p, n, obj->data.sensor);
+    }
+    OBJ(hwmon) {
+      print_sensor(p, n, obj->data.sensor);
     }
     OBJ(kernel) {
       snprintf(p, n, "%s", cur->uname_s.release);
@@ -1048,18 +1892,30 @@ static void generate_text() {
 
     /* memory stuff */
     OBJ(mem) {
-      human_readable(cur->mem*1024, p);
+      human_readable((long long) cur->mem*1024, p);
+    }
+    OBJ(meminfo) {
+      long long v = obj->data.i >= 0 && cur->meminfo ?
+        cur->meminfo[obj->data.i] : -1;
+
+      if (v < 0)
+        ;
+      else if (meminfo_is_count(obj->data.i))
+        snprintf(p, n, "%Ld", v);
+      else
+        human_readable(v*1024, p);
     }
     OBJ(memmax) {
-      human_readable(cur->memmax*1024, p);
+      human_readable((long long) cur->memmax*1024, p);
     }
     OBJ(memperc) {
       if (cur->memmax)
-        snprintf(p, n, "%*d", pad_percents, (cur->mem*100) / (cur->memmax));
+        snprintf(p, n, "%*d", pad_percents,
+            (int) (((long long) cur->mem*100) / cur->memmax));
     }
     OBJ(membar) {
       new_bar(p, obj->data.pair.a, obj->data.pair.b,
-          cur->memmax ? (cur->mem*255) / (cur->memmax) : 0);
+          cur->memmax ? (int) (((long long) cur->mem*255) / cur->memmax) : 0);
     }
 
     /* mixer stuff */
@@ -1087,10 +1943,14 @@ static void generate_text() {
 
     /* mail stuff */
     OBJ(mails) {
-      snprintf(p, n, "%d", cur->mail_count);
+      snprintf(p, n, "%d", obj->data.mail ? obj->data.mail->mail_count : 0);
+    }
+    OBJ(imap_unseen) {
+      snprintf(p, n, "%d", obj->data.imap ? obj->data.imap->unseen : 0);
     }
     OBJ(new_mails) {
-      snprintf(p, n, "%d", cur->new_mail_count);
+      snprintf(p, n, "%d",
+          obj->data.mail ? obj->data.mail->new_mail_count : 0);
     }
 
     OBJ(nodename) {
@@ -1104,12 +1964,82 @@ static void generate_text() {
     OBJ(outlinecolor) {
       new_outline(p, obj->data.l);
     }
+    OBJ(pcount) {
+      snprintf(p, n, "%u", obj->data.pcount ? obj->data.pcount->count : 0);
+    }
+    OBJ(power_dram) {
+      snprintf(p, n, "%.1f", cur->power_dram);
+    }
+    OBJ(power_draw_w) {
+      snprintf(p, n, "%.1f", cur->power_draw);
+    }
+    OBJ(power_pkg) {
+      snprintf(p, n, "%.1f", cur->power_pkg);
+    }
+    OBJ(proc_cpu) {
+      if (obj->data.proc)
+        snprintf(p, n, "%.1f", obj->data.proc->cpu);
+    }
+    OBJ(proc_fds) {
+      if (obj->data.proc)
+        snprintf(p, n, "%d", obj->data.proc->fds);
+    }
+    OBJ(proc_io_read) {
+      if (obj->data.proc)
+        snprintf(p, n, "%d", (int) (obj->data.proc->io_read/1024));
+    }
+    OBJ(proc_rss) {
+      if (obj->data.proc)
+        human_readable(obj->data.proc->rss, p);
+    }
+    OBJ(proc_threads) {
+      if (obj->data.proc)
+        snprintf(p, n, "%d", obj->data.proc->threads);
+    }
+    OBJ(psi) {
+      struct psi_stat *s = obj->data.psi.p;
+
+      if (s == NULL)
+        ;
+      else if (obj->data.psi.field == 3)
+        snprintf(p, n, "%Lu", s->total);
+      else
+        snprintf(p, n, "%.2f", obj->data.psi.field == 0 ? s->avg10 :
+            obj->data.psi.field == 1 ? s->avg60 : s->avg300);
+    }
     OBJ(processes) {
       snprintf(p, n, "%d", cur->procs);
     }
+    OBJ(procs_blocked) {
+      snprintf(p, n, "%d", cur->procs_blocked);
+    }
     OBJ(running_processes) {
       snprintf(p, n, "%d", cur->run_procs);
     }
+    OBJ(runq_latency) {
+      float v = 0;
+      unsigned int i;
+
+      if (obj->data.i >= 0 && (unsigned int) obj->data.i < cur->cores.count)
+        v = cur->cores.runq_latency[obj->data.i];
+      else if (obj->data.i < 0 && cur->cores.count) {
+        /* average of cpus, same scale as one cpu */
+        for (i=0; i<cur->cores.count; i++)
+          v += cur->cores.runq_latency[i];
+        v /= cur->cores.count;
+      }
+      snprintf(p, n, "%.1f", v);
+    }
+    OBJ(runq_latency_max) {
+      float v = 0;
+      unsigned int i;
+
+      for (i=0; i<cur->cores.count; i++) {
+        if (cur->cores.runq_latency[i] > v)
+          v = cur->cores.runq_latency[i];
+      }
+      snprintf(p, n, "%.1f", v);
+    }
     OBJ(text) {
       snprintf(p, n, "%s", obj->data.s);
     }
@@ -1120,21 +2050,34 @@ static void generate_text() {
       new_stippled_hr(p, obj->data.pair.a, obj->data.pair.b);
     }
     OBJ(swap) {
-      human_readable(cur->swap*1024, p);
+      human_readable((long long) cur->swap*1024, p);
     }
     OBJ(swapmax) {
-      human_readable(cur->swapmax*1024, p);
+      human_readable((long long) cur->swapmax*1024, p);
     }
     OBJ(swapperc) {
-      snprintf(p, 255, "%*u", pad_percents, (cur->swap*100) / cur->swapmax);
+      if (cur->swapmax)
+        snprintf(p, 255, "%*u", pad_percents,
+            (unsigned int) (((long long) cur->swap*100) / cur->swapmax));
     }
     OBJ(swapbar) {
       new_bar(p, obj->data.pair.a, obj->data.pair.b,
-          cur->swapmax ? (cur->swap*255) / (cur->swapmax) : 0);
+          cur->swapmax ? (int) (((long long) cur->swap*255) / cur->swapmax) :
+          0);
     }
     OBJ(sysname) {
       snprintf(p, n, "%s", cur->uname_s.sysname);
     }
+    OBJ(thermal) {
+      if (obj->data.thermal && obj->data.thermal->valid)
+        snprintf(p, n, "%.1f", obj->data.thermal->value);
+    }
+    OBJ(thermal_max) {
+      snprintf(p, n, "%.1f", cur->thermal_max);
+    }
+    OBJ(throttle_count) {
+      snprintf(p, n, "%Lu", cur->throttle_count);
+    }
     OBJ(time) {
       time_t t = time(NULL);
       struct tm *tm = localtime(&t);
@@ -1149,6 +2092,16 @@ static void generate_text() {
     OBJ(totaldown) {
       human_readable(obj->data.net->recv, p);
     }
+    OBJ(top) {
+      if (obj->data.top.num)
+        print_top(p, n, &cur->top_cpu[obj->data.top.num-1],
+            obj->data.top.type);
+    }
+    OBJ(top_mem) {
+      if (obj->data.top.num)
+        print_top(p, n, &cur->top_mem[obj->data.top.num-1],
+            obj->data.top.type);
+    }
     OBJ(totalup) {
       human_readable(obj->data.net->trans, p);
     }
@@ -1167,6 +2120,14 @@ static void generate_text() {
     OBJ(uptime) {
       format_seconds(p, n, (int) cur->uptime);
     }
+    OBJ(vmstat) {
+      if (obj->data.vmstat && obj->data.vmstat->valid)
+        snprintf(p, n, "%Lu", obj->data.vmstat->value);
+    }
+    OBJ(vmstat_rate) {
+      if (obj->data.vmstat && obj->data.vmstat->valid)
+        snprintf(p, n, "%.0f", obj->data.vmstat->rate);
+    }
 
 #ifdef SETI
     OBJ(seti_prog) {
@@ -1548,9 +2509,9 @@ static void main_loop() {
     /* wait for X event or timeout */
 
     if (!XPending(display)) {
-      fd_set fdsr;
+      fd_set fdsr, fdse;
       struct timeval tv;
-      int s;
+      int s, maxfd;
       double t = update_interval - (get_time() - last_update_time);
 
       if (t < 0) t = 0;
@@ -1559,9 +2520,11 @@ static void main_loop() {
       tv.tv_usec = (long) (t * 1000000) % 1000000;
 
       FD_ZERO(&fdsr);
+      FD_ZERO(&fdse);
       FD_SET(ConnectionNumber(display), &fdsr);
+      maxfd = set_update_fds(&fdsr, &fdse, ConnectionNumber(display));
 
-      s = select(ConnectionNumber(display) + 1, &fdsr, 0, 0, &tv);
+      s = select(maxfd + 1, &fdsr, 0, &fdse, &tv);
       if (s == -1) {
         if (errno != EINTR)
           ERR("can't select(): %s", strerror(errno));
@@ -1570,6 +2533,9 @@ static void main_loop() {
         /* timeout */
         if (s == 0)
           update_text();
+        /* something that is watched has changed */
+        else if (handle_update_fds(&fdsr, &fdse))
+          update_text();
       }
     }
 
@@ -1767,6 +2733,18 @@ static void reload_handler(int a) {
 
   if (current_config) {
     clear_fs_stats();
+    clear_mail_spools();
+    clear_pcounts();
+    clear_watched_procs();
+    clear_cgroups();
+    clear_psi();
+    clear_vmstat();
+    clear_cstates();
+    clear_hwmon();
+    clear_thermal();
+    clear_power_supplies();
+    clear_rapl();
+    clear_mixer();
     load_config_file(current_config);
     load_font();
     set_font();
@@ -1804,6 +2782,7 @@ static void clean_up() {
 
   free(current_config);
   free(current_mail_spool);
+  clear_imap_passwords();
 #ifdef SETI
   free(seti_dir);
 #endif
@@ -1857,6 +2836,18 @@ static void set_default_configurations(void) {
   gap_x = 5;
   gap_y = 5;
 
+  free(fs_all_format);
+  fs_all_format = strdup("%m %u/%s %p%");
+  free(fs_stale_marker);
+  fs_stale_marker = strdup("?");
+  fs_timeout = 2.0;
+  process_events = 0;
+  free(cgroup_root);
+  cgroup_root = 0;
+  free(powercap_dir);
+  powercap_dir = 0;
+
+  clear_imap_passwords();
   free(current_mail_spool);
   {
     char buf[256];
@@ -1957,6 +2948,10 @@ static void load_config_file(const char *f) {
       else
         CONF_ERR
     }
+    CONF("cgroup_root") {
+      free(cgroup_root);
+      cgroup_root = value ? strdup(value) : 0;
+    }
     CONF("default_color") {
       if (value)
         default_fg_color = get_x11_color(value);
@@ -2023,6 +3018,24 @@ static void load_config_file(const char *f) {
       else
         CONF_ERR
     }
+    CONF("fs_all_format") {
+      if (value) {
+        free(fs_all_format);
+        fs_all_format = strdup(value);
+      }
+      else
+        CONF_ERR
+    }
+    CONF("fs_stale_marker") {
+      free(fs_stale_marker);
+      fs_stale_marker = strdup(value ? value : "");
+    }
+    CONF("fs_timeout") {
+      if (value)
+        fs_timeout = strtod(value, 0);
+      else
+        CONF_ERR
+    }
     CONF("gap_x") {
       if (value)
         gap_x = atoi(value);
@@ -2035,6 +3048,9 @@ static void load_config_file(const char *f) {
       else
         CONF_ERR
     }
+    CONF("imap_password") {
+      add_imap_password(value);
+    }
     CONF("mail_spool") {
       if (value) {
         char buf[256];
@@ -2068,6 +3084,19 @@ static void load_config_file(const char *f) {
     CONF("pad_percents") {
        pad_percents = atoi(value);
     }
+    CONF("powercap_dir") {
+      free(powercap_dir);
+      powercap_dir = value ? strdup(value) : 0;
+    }
+    CONF("process_events") {
+      process_events = string_to_bool(value);
+    }
+    CONF("psi_trigger") {
+      if (value)
+        add_psi_trigger(value);
+      else
+        CONF_ERR
+    }
     CONF("stippled_borders") {
       if(value)
         stippled_borders = strtol(value, 0, 0);
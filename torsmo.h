@@ -3,6 +3,8 @@
 
 #include "config.h"
 #include <sys/utsname.h>
+#include <sys/types.h>
+#include <sys/select.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -22,16 +24,40 @@ struct net_stat {
 };
 
 struct fs_stat {
-  int fd;
   char *path;
   long long size;
   long long avail;
+  long long files;
+  long long ffree;
+  int refs;
+  /* set when statfs() didn't return in fs_timeout (old values are kept) or
+   * fs hasn't been read yet */
+  int stale;
+  pid_t hung_pid;
+  struct fs_stat *next;
+};
+
+/* entry of mount table (/proc/self/mountinfo) */
+struct fs_mount {
+  int id;
+  char *dir;
+  char *type;
+  char *dev;
+  struct fs_stat *fs; /* made when needed */
+  int no_space; /* fs was released because statfs() gave size 0 */
 };
 
 struct cpu_stat {
   unsigned int user, nice, system, idle, iowait, irq, softirq;
 };
 
+/* values of each cpu, arrays are indexed by cpu number */
+struct cpu_cores {
+  unsigned int count;           /* highest cpu number + 1 */
+  float *runq_latency;          /* ms waited in run queue per second */
+  float *freq;                  /* MHz, 0 if unknown */
+};
+
 enum {
   INFO_CPU       = 0,
   INFO_MAIL      = 1,
@@ -50,6 +76,40 @@ enum {
   INFO_LOADAVG   = 12,
   INFO_UNAME     = 13,
   INFO_FREQ      = 14,
+  INFO_TOP       = 15,
+  INFO_PCOUNT    = 16,
+  INFO_PROC      = 17,
+  INFO_CGROUP    = 18,
+  INFO_PSI       = 19,
+  INFO_VMSTAT    = 20,
+  INFO_STAT      = 21,
+  INFO_IRQ       = 22,
+  INFO_SCHED     = 23,
+  INFO_CSTATE    = 24,
+  INFO_THERMAL   = 25,
+  INFO_POWER     = 26,
+  INFO_RAPL      = 27,
+  INFO_ACPI_FAN  = 28,
+  INFO_ADT746X_CPU = 29,
+  INFO_ACPI_AC   = 30,
+  INFO_ADT746X_FAN = 31, /* last bit of need_mask */
+};
+
+#define MAX_TOP 10
+
+struct top_proc {
+  int pid;
+  char name[16];
+  float cpu;            /* percent of one cpu */
+  float mem;            /* percent of physical memory */
+};
+
+#define MAX_IRQ_TOP 10
+
+struct irq_top {
+  char irq[16];         /* like 24 or LOC */
+  char name[32];
+  float rate;           /* per second */
 };
 
 struct information {
@@ -57,7 +117,25 @@ struct information {
 
   struct utsname uname_s;
 
-  char freq[10];
+  /* cpu throttled because of heat, since boot */
+  unsigned long long throttle_count;
+
+  /* hottest thermal zone */
+  double thermal_max;
+
+  /* all batteries, percent is -1 and time is -1 if not known */
+  float battery_total_percent;
+  float power_draw;             /* watts from discharging batteries */
+  int battery_time;             /* seconds to empty */
+  int ac_online;
+
+  /* RAPL, watts of all packages and memory and joules since start */
+  float power_pkg, power_dram;
+  double energy_total;
+
+  /* read once per update, however many objects show them */
+  char acpi_fan[64], acpi_ac_adapter[64];
+  char adt746x_cpu[16], adt746x_fan[64];
   
   double uptime;
 
@@ -65,19 +143,35 @@ struct information {
   unsigned int mem, memmax, swap, swapmax;
   unsigned int bufmem, buffers, cached;
 
+  /* every field of /proc/meminfo (Linux) in kilobytes or pages, -1 if
+   * kernel doesn't have it, indexed by get_meminfo_key() */
+  long long *meminfo;
+
   unsigned int procs;
   unsigned int run_procs;
+  unsigned int procs_blocked;
+
+  /* per second */
+  double ctxt_rate, intr_rate, fork_rate;
 
   float cpu_usage;
   struct cpu_stat cpu_summed;
+  struct cpu_cores cores;
   unsigned int cpu_count;
 
   float loadavg[3];
 
-  int new_mail_count, mail_count;
-
   float seti_prog;
   float seti_credit;
+
+  /* processes using most cpu and memory, pid is 0 if there aren't enough
+   * processes */
+  struct top_proc top_cpu[MAX_TOP], top_mem[MAX_TOP];
+
+  /* busiest interrupts, and interrupts per second by cpu number */
+  struct irq_top irq_top[MAX_IRQ_TOP];
+  float *irq_cpu;
+  unsigned int irq_cpus;
 };
 
 /* in x11.c */
@@ -147,20 +241,40 @@ struct information info;
 void update_uname();
 double get_time(void);
 FILE *open_file(const char *file, int *reported);
+unsigned long raise_fd_limit(unsigned long n);
+#ifdef HAVE_POPEN
+FILE *exec_popen(const char *cmd);
+#endif
 void variable_substitute(const char *s, char *dest, unsigned int n);
 void format_seconds(char *buf, unsigned int n, long t);
 void format_seconds_short(char *buf, unsigned int n, long t);
 struct net_stat *get_net_stat(const char *dev);
+void add_update_fd(int fd, int (*handler)(int fd));
+void add_update_pri_fd(int fd, int (*handler)(int fd));
+void remove_update_fd(int fd);
+int set_update_fds(fd_set *set, fd_set *pri_set, int maxfd);
+int handle_update_fds(fd_set *set, fd_set *pri_set);
 
 void update_stuff();
 
-#define SET_NEED(a) need_mask |= 1 << (a)
+#define SET_NEED(a) need_mask |= 1U << (a)
 extern unsigned int need_mask;
 
 extern double current_update_time, last_update_time;
 
 extern int no_buffers;
 
+#ifdef __linux__
+/* record from getdents64(), glibc may not have it */
+struct linux_dirent64 {
+  unsigned long long d_ino;
+  long long d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+#endif
+
 /* system dependant (in linux.c) */
 
 void prepare_update(void);
@@ -170,20 +284,228 @@ void update_net_stats(void);
 void update_cpu_usage(void);
 void update_total_processes(void);
 void update_running_processes(void);
-char* get_freq();
+void update_stat_counters(void);
+void update_irqs(void);
+void update_schedstat(void);
+void update_freq(void);
+
+/* idle state of cpus, like C6 */
+#define MAX_CSTATES 16
+
+struct cstate {
+  char name[16];
+  float residency;              /* percent of time, average of cpus */
+  float usage;                  /* entries per second, all cpus */
+  float *cpu_residency, *cpu_usage;     /* by cpu number */
+  unsigned int cpus;
+};
+
+struct cstate *get_cstate(const char *name);
+void clear_cstates(void);
+void update_cstates(void);
 void update_load_average();
-int open_i2c_sensor(const char *dev, const char *type, int n, int *div);
-double get_i2c_info(int fd, int arg);
+/* sensor of hwmon chip */
+struct hwmon_sensor {
+  char chip[32];                /* like coretemp */
+  char dev[32];                 /* device of chip, like 0-0290 */
+  char file[16];                /* like temp1 */
+  char label[48];               /* like Package id 0, file if no label */
+  char path[64];                /* in /sys/class/hwmon */
+  int fd;
+  int div;
+  int used;
+  double value;                 /* degrees, volts, watts or rpm */
+  struct hwmon_sensor *next;
+};
+
+struct hwmon_sensor *get_hwmon_sensor(const char *chip, const char *label);
+struct hwmon_sensor *get_i2c_sensor(const char *dev, const char *type, int n);
+void clear_hwmon(void);
+void update_hwmon(void);
 
 char* get_adt746x_cpu(void);
 char* get_adt746x_fan(void);
 
 int open_acpi_temperature(const char *name);
 double get_acpi_temperature(int fd);
+
+/* thermal zone or cooling device */
+struct thermal_dev {
+  char dir[32];                 /* like thermal_zone0 */
+  char type[32];                /* like x86_pkg_temp or Processor */
+  int num;
+  int cooling;
+  int max_state;                /* of cooling device */
+  int fd;
+  int used;
+  int valid;
+  double value;                 /* degrees or cur_state */
+  struct thermal_dev *next;
+};
+
+struct thermal_dev *get_thermal_zone(const char *name);
+struct thermal_dev *get_cooling_device(const char *name);
+void use_all_thermal_zones(void);
+void clear_thermal(void);
+void update_thermal(void);
 char* get_acpi_ac_adapter(void);
 char* get_acpi_fan(void);
 void get_battery_stuff(char *buf, unsigned int n, const char *bat);
 
+/* battery or ac adapter in /sys/class/power_supply */
+struct power_supply {
+  char name[32];                /* like BAT0 or AC */
+  char status[16];              /* like Charging */
+  int battery;
+  int online;
+  int device;                   /* scope is Device, like mouse battery */
+  int capacity;                 /* percent, -1 if not known */
+  double energy, energy_full;   /* Wh */
+  double power, power_avg;      /* W, smoothed for time estimates */
+  int fd;
+  int used;
+  int valid;
+  struct power_supply *next;
+};
+
+struct power_supply *get_power_supply(const char *name);
+void use_all_power_supplies(void);
+int power_supply_time(struct power_supply *s);
+void clear_power_supplies(void);
+void update_power_supplies(void);
+
+extern char *powercap_dir;
+
+void clear_rapl(void);
+void update_rapl(void);
+int get_meminfo_key(const char *name);
+int meminfo_is_count(int key);
+void update_top(void);
+
+/* number of processes with some name */
+struct pcount {
+  char name[16];
+  unsigned int count;
+  struct pcount *next;
+};
+
+extern int process_events;
+
+struct pcount *get_pcount(const char *name);
+void clear_pcounts(void);
+void update_pcounts(void);
+
+/* process from pidfile or by name */
+enum {
+  WATCH_IO  = 1,
+  WATCH_FDS = 2,
+};
+
+struct watched_proc {
+  char *spec;
+  int want;
+  int pid;                      /* 0 if not running */
+
+  float cpu;                    /* percent of one cpu */
+  long long rss;                /* bytes */
+  int threads;
+  int fds;
+  double io_read;               /* bytes per second */
+
+  int stat_fd, io_fd, fd_dir;
+  unsigned long long ticks, starttime, read_bytes;
+  double last_update, last_try;
+
+  struct watched_proc *next;
+};
+
+struct watched_proc *get_watched_proc(const char *spec, int want);
+void clear_watched_procs(void);
+void update_watched_procs(void);
+
+/* cgroup v2 */
+enum {
+  CGROUP_CPU,
+  CGROUP_MEM,
+  CGROUP_MEM_MAX,
+  CGROUP_IO,
+  CGROUP_PIDS,
+  CGROUP_FILES,
+};
+
+struct cgroup_stat {
+  char *path;
+  char *dev;                    /* io.stat device or NULL for all */
+  int want;                     /* 1 << CGROUP_* */
+
+  float cpu;                    /* percent of one cpu */
+  long long mem, mem_max;       /* mem_max is -1 if there's no limit */
+  double io_read, io_write;     /* bytes per second */
+  unsigned int pids;
+
+  int open;
+  int fd[CGROUP_FILES];
+  unsigned long long usage_usec, read_bytes, write_bytes;
+  double last_update, last_try;
+  unsigned int seen;
+
+  struct cgroup_stat *next;
+};
+
+struct cgroup_top_entry {
+  char name[64];                /* empty if there aren't enough */
+  float cpu;
+  long long mem;
+};
+
+struct cgroup_top {
+  char *path;
+  struct cgroup_top_entry top_cpu[MAX_TOP], top_mem[MAX_TOP];
+
+  int dir_fd;
+  int rep;
+  unsigned int generation;
+  struct cgroup_stat *children;
+
+  struct cgroup_top *next;
+};
+
+extern char *cgroup_root;
+
+struct cgroup_stat *get_cgroup_stat(const char *path, const char *dev,
+    int want);
+struct cgroup_top *get_cgroup_top(const char *parent);
+void clear_cgroups(void);
+void update_cgroups(void);
+
+/* pressure stall information */
+#define PSI_RESOURCES 4
+
+struct psi_stat {
+  float avg10, avg60, avg300;
+  unsigned long long total;     /* microseconds */
+};
+
+struct psi_stat *get_psi(const char *resource, int full);
+void add_psi_trigger(const char *arg);
+void clear_psi(void);
+void update_psi(void);
+
+/* counter from /proc/vmstat */
+#define MAX_VMSTAT 32
+
+struct vmstat_counter {
+  char name[32];
+  unsigned long long value;
+  double rate;                  /* per second */
+  int valid;
+  int line;                     /* where it was last time */
+};
+
+struct vmstat_counter *get_vmstat(const char *name);
+void clear_vmstat(void);
+void update_vmstat(void);
+
 #ifdef NVCTRL
 /* in nvctrl.c */
 unsigned int init_nvctrl(const char *feat);
@@ -192,21 +514,95 @@ int get_nvctrl_info(unsigned int arg);
 
 /* fs-stuff is possibly system dependant (in fs.c) */
 
+extern double fs_timeout;
+extern int unread_fs_stats;
+
 void update_fs_stats(void);
 struct fs_stat *prepare_fs_stat(const char *path);
+void release_fs_stat(struct fs_stat *fs);
 void clear_fs_stats(void);
+unsigned int get_fs_mounts(struct fs_mount **mounts);
+struct fs_stat *get_fs_mount_stat(struct fs_mount *m);
+void drop_fs_mount_stat(struct fs_mount *m);
 
 /* in mixer.c */
 
 int mixer_init(const char *);
+void clear_mixer(void);
+void update_mixer(void);
 int mixer_get_avg(int);
 int mixer_get_left(int);
 int mixer_get_right(int);
 
 /* in mail.c */
 
+/* where the last mbox scan stopped */
+struct mbox_scan {
+  off_t offset;         /* end of last complete line */
+  unsigned int sum;     /* checksum of samples before offset */
+  int reading_status;   /* last mail's headers are still being read */
+  int mail_count;
+  int new_mail_count;   /* without last mail if reading_status */
+};
+
+struct mail_spool {
+  char *path;
+  int mail_count, new_mail_count;
+
+  double last_update;
+  time_t last_mtime;
+  int rep;
+
+  /* inotify watches, mbox or maildir's cur and new */
+  int wd[2];
+  int watched, changed;
+  int maildir;          /* counts are updated from inotify events */
+
+  struct mbox_scan mbox;
+
+  struct mail_spool *next;
+};
+
+enum {
+  IMAP_DISCONNECTED,
+  IMAP_GREETING,
+  IMAP_LOGIN,
+  IMAP_CAPABILITY,
+  IMAP_EXAMINE,
+  IMAP_SEARCH,
+  IMAP_IDLE_START,      /* waiting for continuation */
+  IMAP_IDLE,
+  IMAP_DONE,            /* IDLE ended, waiting for tagged reply */
+  IMAP_POLL,            /* server has no IDLE, searched again later */
+};
+
+struct imap_mailbox {
+  char *host, *port, *user, *mailbox;
+  int unseen;
+
+  int fd;
+  int state;
+  int tag;
+  int changed;          /* server told about changes */
+  int idle;             /* server has IDLE capability */
+  int search_count;     /* counted part of long SEARCH reply */
+  char buf[4096];       /* incomplete line */
+  unsigned int len;
+
+  double state_time;
+  double retry_time, backoff;
+  int rep;
+
+  struct imap_mailbox *next;
+};
+
 extern char *current_mail_spool;
 
+struct mail_spool *get_mail_spool(const char *path);
+struct imap_mailbox *get_imap_mailbox(const char *arg);
+void add_imap_password(const char *value);
+void clear_imap_passwords(void);
+void clear_mail_spools(void);
 void update_mail_count();
 
 /* in seti.c */